@@ -22,11 +22,14 @@
 #include "package/part_data.h"
 #include "package/part_entry.h"
 #include "package/relocation_data.h"
+#include "package/object_store.h"
 
 #include "nos/ref.h"
 #include "nos/objects.h"
 
 #include "tools/tools.h"
+#include "tools/output_capture.h"
+#include "tools/thread_pool.h"
 
 #include <iostream>
 #include <fstream>
@@ -34,6 +37,10 @@
 #include <cstdlib>
 #include <locale>
 #include <codecvt>
+#include <filesystem>
+#include <vector>
+#include <memory>
+#include <algorithm>
 
 
 const std::string gnu_as { "/opt/homebrew/bin/arm-none-eabi-as" };
@@ -87,12 +94,270 @@ int objToBin(std::string object_file_name, std::string new_package_name)
   return 0;
 }
 
+/**
+ Print the header and directory of each package as one line of text.
+ Only the directory is read from each file, so this is fast enough to
+ index a whole archive of packages.
+ \param[in] n number of package file names
+ \param[in] package_file_names list of package file names
+ \return 0 if all packages could be scanned
+ */
+int scanPackages(int n, const char * package_file_names[])
+{
+  int ret = 0;
+  pkg::PackageSummary s;
+  std::string line;
+  for (int i = 0; i < n; ++i) {
+    line = package_file_names[i];
+    if (pkg::Package::scanHeader(package_file_names[i], s) < 0) {
+      line += "\tERROR\n";
+      ret = -1;
+    } else {
+      char buf[80];
+      ::snprintf(buf, sizeof(buf), "\t%s\t%s\t0x%08x\t%u\t%u\t%u\t",
+                 s.signature_.c_str(), s.type_.c_str(), s.flags_, s.version_,
+                 s.date_, s.size_);
+      line += buf;
+      line += s.name_ + "\t" + s.copyright_;
+      for (auto &part: s.part_) {
+        ::snprintf(buf, sizeof(buf), "\t%s:0x%08x:%u", part.type_.c_str(), part.flags_, part.size_);
+        line += buf;
+      }
+      line += "\n";
+    }
+    std::cout << line;
+  }
+  return ret;
+}
+
+/**
+ Rebuild each package in memory and compare it to the original file.
+ This needs no assembler and no temporary files.
+ \param[in] n number of package file names
+ \param[in] package_file_names list of package file names
+ \return 0 if all packages were rebuilt identically
+ */
+int verifyPackages(int n, const char * package_file_names[])
+{
+  int ret = 0;
+  for (int i = 0; i < n; ++i) {
+    pkg::Package my_pkg;
+    bool ok = (my_pkg.load(package_file_names[i]) == 0) && (my_pkg.verifyBinary() == 0);
+    std::cout << (ok ? "OK    " : "FAILED") << "  " << package_file_names[i] << std::endl;
+    if (!ok) ret = -1;
+  }
+  return ret;
+}
+
+/**
+ Collect the names of all packages to be converted in a batch.
+ \param[in] source either a text file with one package path per line, or a
+      directory that is searched recursively for files ending in ".pkg"
+ \return list of package file names
+ */
+std::vector<std::string> collectPackages(const std::string &source)
+{
+  std::vector<std::string> files;
+  std::error_code ec;
+  if (std::filesystem::is_directory(source, ec)) {
+    for (auto &entry: std::filesystem::recursive_directory_iterator(source, ec)) {
+      if (!entry.is_regular_file(ec))
+        continue;
+      std::string ext = entry.path().extension().string();
+      for (auto &c: ext) c = (char)std::tolower((unsigned char)c);
+      if (ext == ".pkg")
+        files.push_back(entry.path().string());
+    }
+  } else {
+    std::ifstream list_file { source };
+    std::string line;
+    while (std::getline(list_file, line)) {
+      if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+      if (!line.empty())
+        files.push_back(line);
+    }
+  }
+  return files;
+}
+
+/**
+ Outcome of converting a single package in a batch.
+ */
+struct BatchResult {
+  bool ok_ { false };
+  int warnings_ { 0 };
+  int errors_ { 0 };
+  std::string log_ { };
+};
+
+/**
+ Load a package, convert it to NOS objects, and optionally write it as
+ assembler code. All messages are collected in the result instead of being
+ printed, and exceptions are caught, so that one broken package can't
+ disturb the others.
+ \param[in] package_file_name the package to convert
+ \param[in] assembler_file_name write the assembler file here, or leave empty
+ \param[in] store if set, share converted objects with other packages
+ \param[out] result status and collected messages
+ */
+void convertPackage(const std::string &package_file_name,
+                    const std::string &assembler_file_name,
+                    pkg::ObjectStore *store,
+                    BatchResult &result)
+{
+  OutputCapture::begin(result.log_);
+  try {
+    pkg::Package my_pkg;
+    if (my_pkg.load(package_file_name) < 0) {
+      std::cout << "ERROR reading package file." << std::endl;
+    } else {
+      my_pkg.toNOS(store);
+      // Packages are already converted in parallel, so the parts of one
+      // package are written sequentially instead of nesting thread pools.
+      if (!assembler_file_name.empty() && (my_pkg.writeAsm(assembler_file_name, nullptr) < 0)) {
+        std::cout << "ERROR writing assembler file." << std::endl;
+      } else {
+        result.ok_ = true;
+      }
+    }
+  } catch (std::exception &e) {
+    std::cout << "ERROR: exception: " << e.what() << std::endl;
+    result.ok_ = false;
+  }
+  OutputCapture::end();
+
+  size_t pos = 0;
+  while (pos < result.log_.size()) {
+    if (result.log_.compare(pos, 7, "WARNING") == 0) result.warnings_++;
+    if (result.log_.compare(pos, 5, "ERROR") == 0) result.errors_++;
+    pos = result.log_.find('\n', pos);
+    if (pos == std::string::npos) break;
+    pos++;
+  }
+}
+
+/**
+ Convert a whole list of packages on all available cores.
+ \param[in] source list file or directory, see collectPackages()
+ \param[in] output_dir if not empty, write an assembler file for every
+      package into this directory
+ \param[in] num_threads number of worker threads, 0 for all cores
+ \param[in] dedup convert objects that are the same in many packages only once
+ \return 0 if all packages were converted without errors
+ */
+int batchConvert(const std::string &source, const std::string &output_dir, unsigned num_threads, bool dedup)
+{
+  std::vector<std::string> files = collectPackages(source);
+  if (files.empty()) {
+    std::cout << "ERROR: no packages found in \"" << source << "\"." << std::endl;
+    return -1;
+  }
+  std::vector<BatchResult> results(files.size());
+  std::unique_ptr<pkg::ObjectStore> store;
+  if (dedup)
+    store = std::make_unique<pkg::ObjectStore>();
+  {
+    OutputCapture capture(std::cout);
+    ThreadPool pool(num_threads);
+    // The store can only collect garbage while no package is converted, so
+    // packages are converted in rounds, with a chance to collect in between.
+    size_t round = store ? (size_t)pool.size() * 8 : files.size();
+    for (size_t first = 0; first < files.size(); first += round) {
+      size_t last = std::min(first + round, files.size());
+      for (size_t i = first; i < last; ++i) {
+        std::string asm_name;
+        if (!output_dir.empty()) {
+          std::filesystem::path stem = std::filesystem::path(files[i]).stem();
+          asm_name = (std::filesystem::path(output_dir)
+                      / (std::to_string(i) + "_" + stem.string() + ".s")).string();
+        }
+        pool.submit([&files, &results, &store, i, asm_name]() {
+          convertPackage(files[i], asm_name, store.get(), results[i]);
+        });
+      }
+      pool.wait();
+      if (store)
+        store->maybeCollect();
+    }
+  }
+
+  int n_ok = 0, n_failed = 0, n_warnings = 0;
+  for (size_t i = 0; i < files.size(); ++i) {
+    BatchResult &r = results[i];
+    std::cout << (r.ok_ ? "OK    " : "FAILED")
+              << "  warnings: " << std::setw(4) << std::setfill(' ') << r.warnings_
+              << "  errors: " << std::setw(4) << r.errors_
+              << "  " << files[i] << std::endl;
+    if (!r.ok_)
+      std::cout << r.log_;
+    if (r.ok_) n_ok++; else n_failed++;
+    n_warnings += r.warnings_;
+  }
+  std::cout << files.size() << " packages, " << n_ok << " ok, " << n_failed
+            << " failed, " << n_warnings << " warnings." << std::endl;
+  if (store)
+    store->printStats();
+  return (n_failed > 0) ? -1 : 0;
+}
+
 /**
  Run our application with hardcoded file names for now.
  \param[in] argc, argv
  */
 int main(int argc, const char * argv[])
 {
+  if ((argc>=2) && (std::string(argv[1])=="--scan")) {
+    return (scanPackages(argc-2, argv+2) < 0) ? 1 : 0;
+  }
+  if ((argc>=2) && (std::string(argv[1])=="--verify")) {
+    return (verifyPackages(argc-2, argv+2) < 0) ? 1 : 0;
+  }
+  if ((argc==4) && (std::string(argv[1])=="--rebuild")) {
+    // newtfmt --rebuild <package> <new package>
+    pkg::Package my_pkg;
+    if ((my_pkg.load(argv[2]) < 0) || (my_pkg.writeBinary(argv[3]) < 0))
+      return 1;
+    return 0;
+  }
+  if ((argc==4) && (std::string(argv[1])=="--diff")) {
+    // newtfmt --diff <old package> <new package>
+    pkg::Package old_pkg, new_pkg;
+    if ((old_pkg.load(argv[2]) < 0) || (new_pkg.load(argv[3]) < 0))
+      return 1;
+    int n = old_pkg.diff(new_pkg);
+    if (n < 0)
+      return 1;
+    std::cout << n << " objects differ." << std::endl;
+    return (n > 0) ? 1 : 0;
+  }
+  if ((argc>=4) && (std::string(argv[1])=="--asm")) {
+    // newtfmt --asm [-jN] <package> <assembler file>
+    int i = 2;
+    unsigned num_threads = 0;
+    if ((argc>=5) && (std::string(argv[i]).compare(0, 2, "-j")==0))
+      num_threads = (unsigned)std::atoi(argv[i++]+2);
+    ThreadPool pool(num_threads);
+    pkg::Package my_pkg;
+    if (my_pkg.load(argv[i], pkg::kLoadMapped, &pool) < 0)
+      return 1;
+    return (my_pkg.writeAsm(argv[i+1], &pool) < 0) ? 1 : 0;
+  }
+  if ((argc>=3) && (std::string(argv[1])=="--batch")) {
+    // newtfmt --batch [-jN] [-d] <list file or directory> [output directory]
+    int i = 2;
+    unsigned num_threads = 0;
+    bool dedup = false;
+    for ( ; (i<argc-1) && (argv[i][0]=='-'); ++i) {
+      if (std::string(argv[i]).compare(0, 2, "-j")==0)
+        num_threads = (unsigned)std::atoi(argv[i]+2);
+      else if (std::string(argv[i])=="-d")
+        dedup = true;
+    }
+    std::string source = argv[i++];
+    std::string output_dir = (i<argc) ? argv[i] : "";
+    return (batchConvert(source, output_dir, num_threads, dedup) < 0) ? 1 : 0;
+  }
   if (argc==2) {
     input_pkg_name = argv[1];
   }
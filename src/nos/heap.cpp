@@ -0,0 +1,376 @@
+/*
+ * newtfmt, working title, a Newton Script file reader and writer
+ * Copyright (C) 2025  Matthias Melcher
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "nos/heap.h"
+#include "nos/objects.h"
+
+#include <algorithm>
+
+using namespace nos;
+
+/// The Heap that new objects are created in, or nullptr for the default.
+static thread_local Heap *tCurrentHeap = nullptr;
+
+/** \class nos::Heap
+ Converting a large package creates hundreds of thousands of small objects.
+ Allocating them one by one is slow, and freeing them one by one is even
+ slower, so they all go into a Heap that is dropped with the result.
+
+ Long running tools can keep a Heap and collect garbage instead. Collect()
+ is a copying collector: every object that is reachable from a root is
+ moved into fresh blocks, which compacts the live objects, and the old
+ object is marked as forwarded to its new address. Objects outside of this
+ Heap, like symbols and constant objects, are neither moved nor scanned.
+
+ \note Only Refs in registered roots and in reachable objects are updated.
+      Any other pointer into the Heap is invalid after a collection, so
+      collections must only run at points where no such pointers are held,
+      for example between processing two packages.
+ */
+
+/**
+ Create an empty Heap.
+ \param[in] initial_size size of the first block in bytes, or 0 for a default
+ */
+Heap::Heap(size_t initial_size)
+: next_block_size_(std::max(initial_size, (size_t)16384))
+{
+  SetWatermark(4*1024*1024);
+}
+
+/**
+ Destroy all registered objects and release all memory.
+ */
+Heap::~Heap()
+{
+  for (auto it = finalizer_list_.rbegin(); it != finalizer_list_.rend(); ++it)
+    it->destroy_(it->object_);
+}
+
+/**
+ Start a new block that is large enough for the request.
+ Each new block is twice the size of the previous one.
+ \param[in] size number of bytes
+ \param[in] align alignment, must be a power of two
+ \return pointer to the memory
+ */
+void *Heap::AllocateBlock(size_t size, size_t align)
+{
+  size_t block_size = std::max(next_block_size_, size + align);
+  next_block_size_ = std::min(block_size * 2, (size_t)16*1024*1024);
+  block_list_.push_back({ std::make_unique_for_overwrite<uint8_t[]>(block_size), block_size });
+  ptr_ = block_list_.back().data_.get();
+  avail_ = block_size;
+  return Allocate(size, align);
+}
+
+/**
+ Return the Heap that new objects are created in.
+ \return the Heap of the innermost HeapScope of this thread, or a Heap for
+      this thread that is never released
+ */
+Heap &Heap::Current()
+{
+  if (tCurrentHeap)
+    return *tCurrentHeap;
+  // Intentionally leaked, objects may outlive the thread that created them
+  static thread_local Heap *default_heap = new Heap();
+  return *default_heap;
+}
+
+/**
+ Check if the memory at p belongs to this Heap.
+ \param[in] p any address
+ \return true if p was allocated in this Heap
+ */
+bool Heap::Contains(const void *p) const
+{
+  const uint8_t *b = static_cast<const uint8_t*>(p);
+  for (auto &block: block_list_) {
+    const uint8_t *start = block.data_.get();
+    if ((b >= start) && (b < start + block.size_))
+      return true;
+  }
+  return false;
+}
+
+/**
+ Move all memory and objects of another Heap into this Heap.
+
+ Objects in different Heaps may point at each other, but a collection only
+ updates pointers within the collected Heap. Adopting all related Heaps
+ first lets them be collected together.
+
+ \param[in] other take everything from this Heap, which is empty afterwards
+      and can be used again
+ */
+void Heap::Adopt(Heap &other)
+{
+  for (auto &block: other.block_list_)
+    block_list_.push_back(std::move(block));
+  other.block_list_.clear();
+  finalizer_list_.insert(finalizer_list_.end(), other.finalizer_list_.begin(), other.finalizer_list_.end());
+  other.finalizer_list_.clear();
+  used_ += other.used_;
+  stats_.bytes_allocated_ += other.used_;
+  other.ptr_ = nullptr;
+  other.avail_ = 0;
+  other.used_ = 0;
+}
+
+/**
+ Register a Ref that keeps objects alive during a collection.
+ The Ref is updated when its object moves.
+ \param[in] root address of the Ref, must stay valid until RemoveRoot()
+ */
+void Heap::AddRoot(Ref *root)
+{
+  root_list_.push_back(root);
+}
+
+/**
+ Remove a Ref that was registered with AddRoot().
+ \param[in] root address of the Ref
+ */
+void Heap::RemoveRoot(Ref *root)
+{
+  auto it = std::find(root_list_.begin(), root_list_.end(), root);
+  if (it != root_list_.end())
+    root_list_.erase(it);
+}
+
+/**
+ Set the number of allocated bytes that makes MaybeCollect() collect.
+ After a collection, the watermark is raised to twice the live data if that
+ is more, so that collections don't run again right away.
+ \param[in] bytes the lowest watermark
+ */
+void Heap::SetWatermark(size_t bytes)
+{
+  min_watermark_ = bytes;
+  watermark_ = std::max(bytes, stats_.bytes_live_ * 2);
+}
+
+/**
+ Collect garbage if enough memory was allocated since the last collection.
+ \return true if a collection was run
+ */
+bool Heap::MaybeCollect()
+{
+  if (used_ < watermark_)
+    return false;
+  Collect();
+  return true;
+}
+
+/**
+ Exchange the memory of two Heaps, keeping roots, watermark, and statistics.
+ \param[in] other the other Heap
+ */
+void Heap::Swap(Heap &other)
+{
+  std::swap(block_list_, other.block_list_);
+  std::swap(finalizer_list_, other.finalizer_list_);
+  std::swap(ptr_, other.ptr_);
+  std::swap(avail_, other.avail_);
+  std::swap(next_block_size_, other.next_block_size_);
+  std::swap(used_, other.used_);
+}
+
+/**
+ Copies the reachable objects of a Heap into another Heap.
+ */
+class nos::HeapCollector
+{
+  Heap &from_;
+  Heap &to_;
+  std::vector<std::pair<const uint8_t*, const uint8_t*>> range_list_;
+  std::vector<Object*> work_list_;
+  std::vector<Map*> map_list_;
+
+public:
+  HeapCollector(Heap &from, Heap &to, const std::vector<Heap::Block> &blocks)
+  : from_(from), to_(to)
+  {
+    for (auto &block: blocks)
+      range_list_.push_back({ block.data_.get(), block.data_.get() + block.size_ });
+    std::sort(range_list_.begin(), range_list_.end());
+  }
+
+  /** Check if p is in the Heap that is being collected. */
+  bool InFromSpace(const void *p) const {
+    const uint8_t *b = static_cast<const uint8_t*>(p);
+    auto it = std::upper_bound(range_list_.begin(), range_list_.end(), std::make_pair(b, b),
+      [](auto &a, auto &r) { return a.first < r.first; });
+    if (it == range_list_.begin())
+      return false;
+    --it;
+    return (b >= it->first) && (b < it->second);
+  }
+
+  /** Move data of n bytes if it is in the Heap that is being collected. */
+  char *Move(char *data, size_t n) {
+    if (!data || !InFromSpace(data))
+      return data;
+    char *dst = static_cast<char*>(to_.Allocate(n ? n : 1));
+    ::memcpy(dst, data, n);
+    return dst;
+  }
+
+  /** Move slots and drop the reserve. */
+  Ref *MoveSlots(Ref *slots, Index n) {
+    if (!slots || !InFromSpace(slots))
+      return slots;
+    Ref *dst = to_.AllocateSlots(n);
+    if (n > 0)
+      ::memcpy(dst, slots, (size_t)n * sizeof(Ref));
+    return dst;
+  }
+
+  /**
+   Return the new address of an object, moving it if it was not moved yet.
+   */
+  Object *Forward(Object *obj) {
+    if (!obj || !InFromSpace(obj))
+      return obj;
+    if (obj->f.forward_)
+      return static_cast<Object*>(obj->ptr.value_);
+    // Any array may be a Map, which has a little more data. The extra
+    // bytes are cleared, which drops the index of the Map.
+    size_t size = (obj->t.tag_ == Object::Tag::array) ? std::max(sizeof(Map), sizeof(Object)) : sizeof(Object);
+    void *dst = to_.Allocate(size, alignof(Map));
+    ::memset(dst, 0, size);
+    ::memcpy(dst, (void*)obj, sizeof(Object));
+    Object *moved = static_cast<Object*>(dst);
+    obj->f.forward_ = 1;
+    obj->ptr.value_ = moved;
+    work_list_.push_back(moved);
+    return moved;
+  }
+
+  Ref Forward(Ref ref) {
+    return ref.IsPtr() ? Ref(Forward(ref.GetObject())) : ref;
+  }
+
+  /**
+   Update all Refs in the objects that were moved, moving their children.
+   */
+  void Scan() {
+    while (!work_list_.empty()) {
+      Object *obj = work_list_.back();
+      work_list_.pop_back();
+      switch (obj->t.tag_) {
+        case Object::Tag::binary:
+        case Object::Tag::large_binary:
+          obj->binary.class_ = Forward(obj->binary.class_);
+          obj->binary.data_ = Move(obj->binary.data_, obj->size_);
+          break;
+        case Object::Tag::array: {
+          Index n = (Index)(obj->size_ / sizeof(Ref));
+          obj->array.class_ = Forward(obj->array.class_);
+          obj->array.slot_ = MoveSlots(obj->array.slot_, n);
+          obj->array.reserve_ = 0;
+          for (Index i=0; i<n; ++i)
+            obj->array.slot_[i] = Forward(obj->array.slot_[i]);
+          break; }
+        case Object::Tag::frame: {
+          Index n = (Index)(obj->size_ / sizeof(Ref));
+          if (InFromSpace(obj->frame.map_))
+            map_list_.push_back(obj->frame.map_);
+          obj->frame.map_ = static_cast<Map*>(Forward(static_cast<Object*>(obj->frame.map_)));
+          obj->frame.slot_ = MoveSlots(obj->frame.slot_, n);
+          obj->frame.reserve_ = 0;
+          for (Index i=0; i<n; ++i)
+            obj->frame.slot_[i] = Forward(obj->frame.slot_[i]);
+          break; }
+        case Object::Tag::real:
+          obj->real.class_ = Forward(obj->real.class_);
+          break;
+        case Object::Tag::symbol:
+          obj->symbol.string_ = Move(obj->symbol.string_, obj->size_);
+          break;
+        case Object::Tag::native_ptr:
+          obj->ptr.class_ = Forward(obj->ptr.class_);
+          break;
+        case Object::Tag::reserved:
+          break;
+      }
+    }
+  }
+
+  /**
+   Give the maps of all moved frames a new index, as the old one was dropped.
+   Must be called after Scan(), when the tags were moved.
+   */
+  void BuildIndexes() {
+    for (auto &map: map_list_)
+      map = static_cast<Map*>(Forward(static_cast<Object*>(map)));
+    std::sort(map_list_.begin(), map_list_.end());
+    map_list_.erase(std::unique(map_list_.begin(), map_list_.end()), map_list_.end());
+    for (auto map: map_list_)
+      map->BuildIndex(to_);
+  }
+};
+
+/**
+ Move all objects that can be reached from the roots into new blocks and
+ release everything else.
+ */
+void Heap::Collect()
+{
+  Heap to(std::max(used_ / 2, (size_t)16384));
+  {
+    HeapCollector collector(*this, to, block_list_);
+    for (auto root: root_list_)
+      *root = collector.Forward(*root);
+    collector.Scan();
+    collector.BuildIndexes();
+  }
+  // Arrays are moved with room for a Map, so the copy can be a little larger
+  size_t freed = (used_ > to.used_) ? (used_ - to.used_) : 0;
+  Swap(to);
+  stats_.collections_++;
+  stats_.bytes_live_ = used_;
+  stats_.bytes_freed_ += freed;
+  watermark_ = std::max(min_watermark_, used_ * 2);
+  // "to" now holds the old blocks and finalizers and releases them
+}
+
+/** \class nos::HeapScope
+ Create all objects in the given Heap until the scope ends.
+ */
+
+/**
+ Make heap the current Heap of the calling thread.
+ \param[in] heap create new objects here
+ */
+HeapScope::HeapScope(Heap &heap)
+: previous_(tCurrentHeap)
+{
+  tCurrentHeap = &heap;
+}
+
+/**
+ Restore the previous Heap.
+ */
+HeapScope::~HeapScope()
+{
+  tCurrentHeap = previous_;
+}
+
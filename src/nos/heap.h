@@ -0,0 +1,186 @@
+/*
+ * newtfmt, working title, a Newton Script file reader and writer
+ * Copyright (C) 2025  Matthias Melcher
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef NEWTFMT_NOS_HEAP_H
+#define NEWTFMT_NOS_HEAP_H
+
+#include "nos/types.h"
+#include "nos/ref.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace nos {
+
+class Object;
+class HeapCollector;
+
+/**
+ Statistics of a Heap, see Heap::Stats().
+ */
+struct HeapStats {
+  /// Number of garbage collections run so far.
+  size_t collections_ { 0 };
+  /// Bytes allocated since the Heap was created, including collected bytes.
+  size_t bytes_allocated_ { 0 };
+  /// Bytes that survived the last collection.
+  size_t bytes_live_ { 0 };
+  /// Bytes released by all collections together.
+  size_t bytes_freed_ { 0 };
+};
+
+/**
+ A bump pointer arena that owns NewtonScript objects and their slots.
+
+ Memory is carved out of large blocks and released all at once when the
+ Heap is destroyed. Objects that need a destructor to release memory of
+ their own are registered and destroyed with the Heap.
+
+ All objects are created in the current Heap of the calling thread, see
+ HeapScope. Without a HeapScope, a per thread heap is used that is never
+ released.
+
+ Collect() copies all objects that can be reached from the registered roots
+ into new blocks and releases the old blocks.
+ */
+class Heap
+{
+  friend class HeapCollector;
+
+  struct Finalizer {
+    void (*destroy_)(void*);
+    void *object_;
+  };
+
+  struct Block {
+    std::unique_ptr<uint8_t[]> data_;
+    size_t size_;
+  };
+
+  std::vector<Block> block_list_;
+  std::vector<Finalizer> finalizer_list_;
+  std::vector<Ref*> root_list_;
+  uint8_t *ptr_ { nullptr };
+  size_t avail_ { 0 };
+  size_t next_block_size_ { 0 };
+  size_t used_ { 0 };
+  size_t watermark_ { 0 };
+  size_t min_watermark_ { 0 };
+  HeapStats stats_ { };
+
+  void *AllocateBlock(size_t size, size_t align);
+  void Swap(Heap &other);
+
+public:
+  Heap(size_t initial_size = 0);
+  ~Heap();
+  Heap(Heap const& rhs) = delete;
+  Heap& operator=(Heap const& rhs) = delete;
+
+  static Heap &Current();
+
+  /** Number of bytes handed out so far. */
+  size_t Used() const { return used_; }
+
+  /** Statistics about allocations and collections. */
+  const HeapStats &Stats() const { return stats_; }
+
+  bool Contains(const void *p) const;
+  void Adopt(Heap &other);
+  void AddRoot(Ref *root);
+  void RemoveRoot(Ref *root);
+  void SetWatermark(size_t bytes);
+  void Collect();
+  bool MaybeCollect();
+
+  /**
+   Return a block of uninitialized memory.
+   \param[in] size number of bytes
+   \param[in] align alignment, must be a power of two
+   \return pointer to the memory, valid for the lifetime of the Heap
+   */
+  void *Allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+    size_t pad = (size_t)(-(uintptr_t)ptr_) & (align - 1);
+    if (pad + size > avail_)
+      return AllocateBlock(size, align);
+    uint8_t *p = ptr_ + pad;
+    ptr_ = p + size;
+    avail_ -= pad + size;
+    used_ += size;
+    stats_.bytes_allocated_ += size;
+    return p;
+  }
+
+  /** Construct an object of type T in the Heap. */
+  template<class T, class... Args>
+  T *New(Args&&... args) {
+    T *obj = new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    if constexpr (!std::is_trivially_destructible_v<T>)
+      finalizer_list_.push_back({ [](void *o) { static_cast<T*>(o)->~T(); }, obj });
+    return obj;
+  }
+
+  /** Allocate n slots, all set to NIL. */
+  Ref *AllocateSlots(Index n) {
+    Ref *slots = static_cast<Ref*>(Allocate((size_t)(n > 0 ? n : 1) * sizeof(Ref), alignof(Ref)));
+    for (Index i = 0; i < n; ++i)
+      new (slots + i) Ref();
+    return slots;
+  }
+
+  /** Allocate n bytes, all set to zero. */
+  void *AllocateZeroed(size_t n) {
+    void *p = Allocate(n ? n : 1);
+    ::memset(p, 0, n);
+    return p;
+  }
+
+  /** Copy a string into the Heap and add a trailing NUL. */
+  char *CopyString(std::string_view s) {
+    char *p = static_cast<char*>(Allocate(s.size() + 1, 1));
+    ::memcpy(p, s.data(), s.size());
+    p[s.size()] = 0;
+    return p;
+  }
+};
+
+/**
+ Make a Heap the current Heap of this thread while the scope exists.
+ */
+class HeapScope
+{
+  Heap *previous_;
+public:
+  HeapScope(Heap &heap);
+  ~HeapScope();
+  HeapScope(HeapScope const& rhs) = delete;
+  HeapScope& operator=(HeapScope const& rhs) = delete;
+};
+
+} // namespace nos
+
+#endif // NEWTFMT_NOS_HEAP_H
+
@@ -18,18 +18,33 @@
 
 
 #include "nos/objects.h"
+#include "nos/heap.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
 
 using namespace nos;
 
+/**
+ Maps slot tags to their index in a large map.
+ */
+struct nos::MapIndex {
+  std::unordered_multimap<size_t, Index> tags_;
+  /// Number of map slots that were added to the index; slot 0 is the supermap.
+  Index covered_ { 1 };
+};
+
 // MARK : - nos::Object1 -
 // MARK : - nos::Object2
 // MARK : nos::Object3
 // MARK : -
 
 nos::Object::Object(const std::string &str)
-: t { Tag::binary, 0x10 }, size_{ (uint32_t)::strlen(str.c_str()) }, binary{ gSymString, ::strdup(str.c_str()) }
+: t { Tag::binary, 0x10 }, size_{ (uint32_t)str.size()+1 }, binary{ gSymString, Heap::Current().CopyString(str) }
 { }
 
 Index nos::SlottedObject::Length() const {
@@ -45,12 +60,17 @@ void nos::SlottedObject::SetLength(Index new_length)
   Index avail = old_length + array.reserve_;
 
   if (new_length <= avail) {
-    // TODO: we may want to shrink here if the difference is too much
+    // Slots in the Heap can't be returned one by one. Heap::Collect()
+    // drops the unused reserve when it moves the object.
     array.reserve_ = (uint32_t)(avail - new_length);
   } else {
-    array.reserve_ = (new_length>16) ? 9 : 5; // Rather random values
+    // Slots in the Heap can't be resized in place, so grow by half of the
+    // length to keep appending slots linear in time
+    array.reserve_ = (uint32_t)std::max(new_length/2, (Index)4);
     avail = new_length + array.reserve_;
-    array.slot_ = (Ref*)::realloc(array.slot_, avail * sizeof(Ref));
+    Ref *slots = Heap::Current().AllocateSlots(avail);
+    ::memcpy(slots, array.slot_, (size_t)old_length * sizeof(Ref));
+    array.slot_ = slots;
   }
   size_ = (uint32_t)(new_length * sizeof(Ref));
   if (new_length > old_length) {
@@ -61,6 +81,47 @@ void nos::SlottedObject::SetLength(Index new_length)
   }
 }
 
+/**
+ Make room for a number of slots without changing the length.
+ Filling the slots with AddSlot() or SetLength() won't reallocate them.
+ \param[in] capacity total number of slots
+ */
+void nos::SlottedObject::Reserve(Index capacity)
+{
+  Index old_length = Length();
+  if (capacity <= old_length + (Index)array.reserve_)
+    return;
+  Ref *slots = Heap::Current().AllocateSlots(capacity);
+  ::memcpy(slots, array.slot_, (size_t)old_length * sizeof(Ref));
+  array.slot_ = slots;
+  array.reserve_ = (uint32_t)(capacity - old_length);
+}
+
+/**
+ Set all slots at once.
+ \param[in] values one value for every slot up to Length()
+ */
+void nos::SlottedObject::CopySlots(const Ref *values)
+{
+  Index n = Length();
+  if (n > 0)
+    ::memcpy((void*)array.slot_, values, (size_t)n * sizeof(Ref));
+}
+
+/**
+ Insert a slot and move all following slots up by one.
+ \param[in] i index of the new slot, may be the current length to append
+ \param[in] value the value of the new slot
+ */
+void nos::SlottedObject::InsertSlot(Index i, RefArg value)
+{
+  Index len = Length();
+  assert((i >= 0) && (i <= len));
+  SetLength(len + 1);
+  ::memmove(array.slot_ + i + 1, array.slot_ + i, (size_t)(len - i) * sizeof(Ref));
+  array.slot_[i] = value;
+}
+
 Ref nos::SlottedObject::GetSlot(Index i) const {
   if ((t.tag_==Tag::array) || (t.tag_==Tag::frame)) {
     if (i<(Index)(size()/sizeof(Ref))) {
@@ -124,50 +185,61 @@ int nos::Object::Print(PrintState &ps) const
     case Tag::binary:
       // TODO: binary.class_ is not necessarily an object!
       if (binary.class_.GetObject()->SymbolCompare(&gSymObjString)==0) {
-        fprintf(ps.out_, "\"%s\"", binary.data_); // TODO: must escape characters, is \0 always at the end?
+        // TODO: must escape characters, is \0 always at the end?
+        ps.put('"');
+        ps.put(binary.data_);
+        ps.put('"');
       } else {
         //'samples, 'instructions, 'code, 'bits, 'mask, 'cbits etc.
-        fprintf(ps.out_, "binary(");
+        ps.put("binary(");
         ps.expect_symbol(true);
         binary.class_.Print(ps);
         ps.expect_symbol(false);
-        fprintf(ps.out_, ": <%ld bytes>)", size());
+        ps.put(": <");
+        ps.put_int((int64_t)size());
+        ps.put(" bytes>)");
       }
       break;
     case Tag::large_binary:
-      fprintf(ps.out_, "large_binary('");
+      ps.put("large_binary('");
       ps.expect_symbol(true);
       binary.class_.Print(ps);
       ps.expect_symbol(false);
-      fprintf(ps.out_, ": <%ld bytes>)", size());
+      ps.put(": <");
+      ps.put_int((int64_t)size());
+      ps.put(" bytes>)");
       break;
     case Tag::array:
       if (ps.more_depth()) {
         static_cast<const Array*>(this)->Print(ps);
       } else {
-        fprintf(ps.out_, "<0x%016lx>", (uintptr_t)this);
+        ps.put("<0x");
+        ps.put_hex((uintptr_t)this, 16);
+        ps.put('>');
       }
       break;
     case Tag::frame:
       if (ps.more_depth()) {
         static_cast<const Frame*>(this)->Print(ps);
       } else {
-        fprintf(ps.out_, "<0x%016lx>", (uintptr_t)this);
+        ps.put("<0x");
+        ps.put_hex((uintptr_t)this, 16);
+        ps.put('>');
       }
       break;
     case Tag::real:
-      fprintf(ps.out_, "%g", real.value_);
+      ps.put_real(real.value_);
       break;
     case Tag::symbol:
       if (!ps.symbol_expected())
-        fprintf(ps.out_, "'");
-      fprintf(ps.out_, "%s", symbol.string_);
+        ps.put('\'');
+      ps.put(symbol.string_);
       break;
     case Tag::native_ptr:
-      fprintf(ps.out_, "<NativePtr>");
+      ps.put("<NativePtr>");
       break;
     case Tag::reserved:
-      fprintf(ps.out_, "<Reserved>");
+      ps.put("<Reserved>");
       break;
   }
   return 0;
@@ -175,12 +247,63 @@ int nos::Object::Print(PrintState &ps) const
 
 // Flags can be 1 (kMapSorted), 2(kMapShared), 4 (kMapProto)
 nos::Frame::Frame()
-: SlottedObject( Frame_{ new Map(Ref(0), 1), new Ref[4], 4 }, 0)
+: SlottedObject( Frame_{ Heap::Current().New<Map>(Ref(0), 1), Heap::Current().AllocateSlots(4), 4 }, 0)
 { }
 
+/**
+ Create an empty frame with its own map and room for a number of slots.
+ \param[in] capacity number of slots that can be set without reallocation
+ */
+nos::Frame::Frame(Index capacity)
+: SlottedObject( Frame_{ Heap::Current().New<Map>(Ref(0), 1), Heap::Current().AllocateSlots(capacity), (uint32_t)capacity }, 0)
+{
+  frame.map_->Reserve(capacity + 1);
+}
+
+/**
+ Create a frame that shares an existing map.
+ \param[in] map the map with the slot tags, will be marked as shared
+ \param[in] length number of slots, must match the number of tags in the map
+ \param[in] values the slot values, copied into the frame
+ */
+nos::Frame::Frame(Map *map, Index length, const Ref *values)
+: SlottedObject( Frame_{ map, Heap::Current().AllocateSlots(length), 0 }, (uint32_t)length)
+{
+  for (Index i=0; i<length; ++i)
+    frame.slot_[i] = values[i];
+  // Maps that are already shared may be read by other threads
+  if (!(map->Flags() & kMapShared))
+    map->SetFlags(map->Flags() | kMapShared);
+}
+
 Ref nos::AllocateFrame()
 {
-  return Ref(new nos::Frame());
+  return Ref(Heap::Current().New<nos::Frame>());
+}
+
+/**
+ Create an empty frame that can take a number of slots without reallocation.
+ \param[in] capacity expected number of slots
+ \return the new frame
+ */
+Ref nos::AllocateFrame(Index capacity)
+{
+  return Ref(Heap::Current().New<nos::Frame>(capacity));
+}
+
+/**
+ Create a frame with all its slots at once, sharing the given map.
+ \param[in] map_ref a map with a tag for every slot and no supermap
+ \param[in] length number of slots
+ \param[in] values the slot values in the order of the tags in the map
+ \return the new frame
+ */
+Ref nos::AllocateFrame(RefArg map_ref, Index length, const Ref *values)
+{
+  if (!map_ref.IsArray())
+    throw BadTypeWithFrameData(kNSErrNotAnArray);
+  Map *map = static_cast<Map*>(map_ref.GetObject());
+  return Ref(Heap::Current().New<nos::Frame>(map, length, values));
 }
 
 void nos::SetFrameSlot(RefArg obj, RefArg tag, RefArg value)
@@ -196,11 +319,11 @@ void nos::SetFrameSlot(RefArg obj, RefArg tag, RefArg value)
 }
 
 nos::Array::Array(RefArg obj_class, Index length)
-: SlottedObject( Array_{ obj_class, new Ref[length], 0 }, (uint32_t)length)
+: SlottedObject( Array_{ obj_class, Heap::Current().AllocateSlots(length), 0 }, (uint32_t)length)
 { }
 
 nos::Array::Array(RefArg obj_class)
-: SlottedObject( Array_{ obj_class, new Ref[4], 4 }, 0)
+: SlottedObject( Array_{ obj_class, Heap::Current().AllocateSlots(4), 4 }, 0)
 { }
 
 nos::Map::Map(RefArg obj_class, Index length)
@@ -211,9 +334,187 @@ nos::Map::Map(RefArg obj_class)
 : Array(obj_class)
 { }
 
+/**
+ Create an unshared copy of a map.
+ \param[in] other copy the tags from this map
+ */
+nos::Map::Map(const Map &other)
+: Array(Ref(other.Flags() & ~kMapShared), other.Length())
+{
+  for (Index i=0; i<other.Length(); ++i)
+    array.slot_[i] = other.GetSlot(i);
+}
+
+/**
+ The map flags are stored as an integer in the class slot.
+ \return kMapSorted, kMapShared, and kMapProto flags
+ */
+Integer nos::Map::Flags() const
+{
+  return array.class_.GetInteger();
+}
+
+void nos::Map::SetFlags(Integer flags)
+{
+  array.class_ = Ref(flags);
+}
+
+/**
+ Check if the tags in this map are sorted.
+ \return true if kMapSorted is set
+ */
+bool nos::Map::IsSorted() const
+{
+  return (Flags() & kMapSorted) != 0;
+}
+
+/**
+ Clear kMapSorted if the tags are not sorted the way SymbolCompare() sorts.
+ NewtonOS sorts by its own symbol hash, so maps that were read from a
+ package are generally not in our order.
+ */
+void nos::Map::VerifySorted()
+{
+  if (!IsSorted())
+    return;
+  Index n = Length();
+  for (Index i=1; i<n; ++i) {
+    Ref tag = array.slot_[i];
+    if (!tag.IsSymbol() || ((i > 1) && (nos::SymbolCompare(array.slot_[i-1], tag) >= 0))) {
+      SetFlags(Flags() & ~kMapSorted);
+      return;
+    }
+  }
+}
+
+/**
+ Binary search for a tag in a sorted map.
+ \param[in] tag a symbol
+ \param[out] found set if the tag is in the map
+ \return index in the map of the tag, or where it would have to be inserted
+ */
+Index nos::Map::FindSorted(RefArg tag, bool &found) const
+{
+  Index lo = 1, hi = Length();
+  while (lo < hi) {
+    Index mid = lo + (hi - lo) / 2;
+    if (nos::SymbolCompare(array.slot_[mid], tag) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  found = (lo < Length()) && (nos::SymbolCompare(array.slot_[lo], tag) == 0);
+  return lo;
+}
+
+/**
+ Hash the case folded text of a symbol for the map index.
+ The hash stored in the symbol is too weak to spread many similar tags.
+ */
+static size_t tag_hash(RefArg tag)
+{
+  size_t h = 14695981039346656037ULL;
+  for (const char *s = static_cast<Symbol*>(tag.GetObject())->Name(); *s; ++s) {
+    h ^= (size_t)std::tolower((unsigned char)*s);
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+/**
+ Add the tags of a large unsorted map to its hash index.
+
+ The index is created in the same Heap as the map, so that both are released
+ together. Call this when the map is created or a tag was added, but never
+ once the map is shared, because other threads may be reading the index.
+
+ \param[in] heap the Heap that holds the map
+ */
+void nos::Map::BuildIndex(Heap &heap)
+{
+  Index n = Length();
+  if (IsSorted() || (n <= kMapIndexThreshold))
+    return;
+  if (!index_)
+    index_ = heap.New<MapIndex>();
+  for (; index_->covered_ < n; ++index_->covered_) {
+    Ref t = array.slot_[index_->covered_];
+    if (t.IsSymbol())
+      index_->tags_.emplace(tag_hash(t), index_->covered_);
+  }
+}
+
+/**
+ Find the slot for a tag.
+
+ Sorted maps use a binary search. Large unsorted maps use their hash index
+ if it covers all tags, see BuildIndex(). All other maps are searched one
+ tag at a time. The map is not changed, so shared maps can be searched by
+ many threads at once.
+
+ \param[in] tag a symbol
+ \return index of the slot in a frame using this map, or -1 if not found
+ */
+Index nos::Map::FindTag(RefArg tag) const
+{
+  Index n = Length(); // TODO: index[0] may point to a super map!
+  if (!tag.IsSymbol())
+    return -1;
+  if (IsSorted()) {
+    bool found;
+    Index i = FindSorted(tag, found);
+    return found ? i-1 : -1;
+  }
+  if (index_ && (index_->covered_ == n)) {
+    auto range = index_->tags_.equal_range(tag_hash(tag));
+    Index best = -1;
+    for (auto it = range.first; it != range.second; ++it) {
+      if (((best == -1) || (it->second < best))
+          && (nos::SymbolCompare(array.slot_[it->second], tag) == 0))
+        best = it->second;
+    }
+    return (best == -1) ? -1 : best-1;
+  }
+  for (Index i=1; i<n; ++i) {
+    if (nos::SymbolCompare(array.slot_[i], tag)==0)
+      return i-1;
+  }
+  return -1;
+}
+
+/**
+ Add a tag to the map, keeping sorted maps sorted.
+ \param[in] tag a symbol that is not yet in the map
+ \return index of the tag in the map
+ */
+Index nos::Map::AddTag(RefArg tag)
+{
+  if (IsSorted()) {
+    bool found;
+    Index i = FindSorted(tag, found);
+    InsertSlot(i, tag);
+    return i;
+  }
+  return AddSlot(tag);
+}
+
 Ref nos::AllocateArray(RefArg theClass, Index length)
 {
-  return Ref(new nos::Array(theClass, length));
+  return Ref(Heap::Current().New<nos::Array>(theClass, length));
+}
+
+/**
+ Create an array with all its slots at once.
+ \param[in] theClass class of the array
+ \param[in] length number of slots
+ \param[in] values the slot values, copied into the array
+ \return the new array
+ */
+Ref nos::AllocateArray(RefArg theClass, Index length, const Ref *values)
+{
+  Array *array = Heap::Current().New<nos::Array>(theClass, length);
+  array->CopySlots(values);
+  return Ref(array);
 }
 
 Ref nos::AllocateArray(Index length)
@@ -221,6 +522,31 @@ Ref nos::AllocateArray(Index length)
   return AllocateArray(kRefArray, length);
 }
 
+/**
+ Create a map for frames.
+ \param[in] flags kMapSorted, kMapShared, and kMapProto as an integer Ref
+ \param[in] length number of slots, including the supermap in slot 0
+ \return the new map
+ */
+Ref nos::AllocateMap(RefArg flags, Index length)
+{
+  return Ref(Heap::Current().New<nos::Map>(flags, length));
+}
+
+/**
+ Create a map for frames with all its tags at once.
+ \param[in] flags kMapSorted, kMapShared, and kMapProto as an integer Ref
+ \param[in] length number of slots, including the supermap in slot 0
+ \param[in] values the supermap followed by the slot tags
+ \return the new map
+ */
+Ref nos::AllocateMap(RefArg flags, Index length, const Ref *values)
+{
+  Map *map = Heap::Current().New<nos::Map>(flags, length);
+  map->CopySlots(values);
+  return Ref(map);
+}
+
 Index nos::Array::AddSlot(RefArg value)
 {
   Index len = Length();
@@ -232,29 +558,37 @@ Index nos::Array::AddSlot(RefArg value)
 
 void nos::Frame::SetSlot(RefArg tag, RefArg value)
 {
-  // TODO: frame.map_->FIndOffset(tag);
-  Index i = FindOffset(frame.map_, tag);
+  Index i = frame.map_->FindTag(tag);
   if (i == -1) {
-    i = frame.map_->AddSlot(tag);
+    // Other frames use the same map, so this frame needs its own copy
+    if (frame.map_->Flags() & kMapShared)
+      frame.map_ = Heap::Current().New<Map>(*frame.map_);
+    i = frame.map_->AddTag(tag);
     if (i == -1)
       return; // TODO: throw
-    SetLength(i);
+    // Without a Heap for the index, the map is searched without one
+    if ((frame.map_->Length() > kMapIndexThreshold) && Heap::Current().Contains(frame.map_))
+      frame.map_->BuildIndex(Heap::Current());
+    // A sorted map may have inserted the tag before existing tags
+    InsertSlot(i-1, value);
+    return;
   }
-  assert((i-1 >= 0) && (i-1 < (Index)(size_/sizeof(Ref))));
-  frame.slot_[i-1] = value;
+  assert((i >= 0) && (i < (Index)(size_/sizeof(Ref))));
+  frame.slot_[i] = value;
 }
 
+/**
+ Find the slot for a tag in a frame map.
+ \param[in] map_ref a map
+ \param[in] tag a symbol
+ \return index of the slot in a frame using this map, or -1 if not found
+ */
 Index nos::FindOffset(Ref map_ref, Ref tag)
 {
   if (!map_ref.IsArray())
     return -1; // TODO: throw
-  Array *map = static_cast<Array*>(map_ref.GetObject());
-  Index i = 1, n = map->Length(); // TODO: index[0] may point to a super map!
-  for (;i<n;++i) {
-    if (SymbolCompare(map->GetSlot(i), tag)==0)
-      return i-1;
-  }
-  return -1;
+  Map *map = static_cast<Map*>(map_ref.GetObject());
+  return map->FindTag(tag);
 }
 
 //Index nos::Frame::AddSlot(RefArg tag)
@@ -273,6 +607,17 @@ bool nos::IsReadOnly(RefArg ref)
   }
 }
 
+/**
+ Protect an object from being changed.
+ Setting slots of a read-only array or frame throws an exception.
+ \param[in] ref any Ref, immediates are always read-only
+ */
+void nos::SetReadOnly(RefArg ref)
+{
+  if (IsPtr(ref))
+    ref.GetObject()->SetReadOnly(true);
+}
+
 Index nos::AddArraySlot(RefArg array_ref, RefArg value)
 {
   if (!array_ref.IsArray())
@@ -297,67 +642,142 @@ Ref nos::GetArraySlot(RefArg array_obj, Index slot)
   return RefNIL;
 }
 
-int nos::Array::Print(PrintState &ps) const
+/**
+ Print arrays and frames for a GraphWalker, so that deeply nested objects
+ don't recurse.
+
+ Slots that hold arrays or frames are entered if the print depth allows it,
+ all other slots are printed right away.
+ */
+class nos::PrintVisitor
 {
-  fprintf(ps.out_, "[\n");
-  ps.incr_depth();
-  if (!array.class_.IsSymbol() || ::SymbolCompare(array.class_, kSymArray)!=0) {
-    ps.tab();
-    ps.expect_symbol(true);
-    array.class_.Print(ps);
-    ps.expect_symbol(false);
-    fprintf(ps.out_, ":\n");
+  PrintState &ps_;
+public:
+  PrintVisitor(PrintState &ps) : ps_(ps) { }
+  bool enter(const SlottedObject *obj) {
+    if (obj->IsArray()) {
+      ps_.put("[\n");
+      ps_.incr_depth();
+      if (!obj->array.class_.IsSymbol() || ::SymbolCompare(obj->array.class_, kSymArray)!=0) {
+        ps_.tab();
+        ps_.expect_symbol(true);
+        obj->array.class_.Print(ps_);
+        ps_.expect_symbol(false);
+        ps_.put(":\n");
+      }
+    } else {
+      ps_.put("{\n");
+      ps_.incr_depth();
+    }
+    return true;
+  }
+  bool next(const SlottedObject *obj, size_t &i, const SlottedObject *&child) {
+    size_t n = obj->size()/sizeof(Ref);
+    while (i < n) {
+      if (i > 0)
+        ps_.put(",\n");
+      ps_.tab();
+      Ref value;
+      if (obj->IsArray()) {
+        value = obj->array.slot_[i];
+      } else {
+        ps_.expect_symbol(true);
+        obj->frame.map_->GetSlot((Index)i+1).Print(ps_);
+        ps_.expect_symbol(false);
+        ps_.put(": ");
+        value = obj->GetSlot((Index)i);
+      }
+      ++i;
+      if ((value.IsArray() || value.IsFrame()) && ps_.more_depth()) {
+        child = static_cast<const SlottedObject*>(value.GetObject());
+        return true;
+      }
+      value.Print(ps_);
+    }
+    return false;
   }
-  int i, n = (int)(size()/sizeof(Ref));
-  for (i=0; i<n; ++i) {
-    ps.tab();
-    array.slot_[i].Print(ps);
-    if (i+1<n) fprintf(ps.out_, ",");
-    fprintf(ps.out_, "\n");
+  void leave(const SlottedObject *obj) {
+    if (obj->size() > 0)
+      ps_.put('\n');
+    ps_.decr_depth();
+    ps_.tab();
+    ps_.put(obj->IsArray() ? ']' : '}');
   }
-  ps.decr_depth();
-  ps.tab();
-  fprintf(ps.out_, "]");
+};
+
+int nos::Array::Print(PrintState &ps) const
+{
+  PrintVisitor visitor(ps);
+  ps.walker().walk(this, visitor);
   return 0;
 }
 
 int nos::Frame::Print(PrintState &ps) const
 {
-  fprintf(ps.out_, "{\n");
-  ps.incr_depth();
-  int i, n = (int)(size()/sizeof(Ref));
-  for (i=0; i<n; ++i) {
-    ps.tab();
-    ps.expect_symbol(true);
-    frame.map_->GetSlot(i+1).Print(ps);
-    ps.expect_symbol(false);
-    fprintf(ps.out_, ": ");
-    GetSlot(i).Print(ps);
-    if (i+1<n) fprintf(ps.out_, ",");
-    fprintf(ps.out_, "\n");
-  }
-  ps.decr_depth();
-  ps.tab();
-  fprintf(ps.out_, "}");
+  PrintVisitor visitor(ps);
+  ps.walker().walk(this, visitor);
   return 0;
 }
 
 Ref nos::MakeString(const char *str) {
-  return Ref(new Object(::strdup(str)));
+  Heap &heap = Heap::Current();
+  return Ref(heap.New<Object>(heap.CopyString(str)));
 }
 
-Ref nos::Sym(const char *name) {
-  // TODO: check if the symbol already exists in the global symbols list
-  // TODO: if it exists, return a Ref to the global symbol and return
-  // TODO: if not, we must add it to the list
-  // TODO: if list of known symbols is read-only, clone the list
-  // TODO: return a Ref to the global symbol and return
-  return Ref(new Symbol(::strdup(name)));
+namespace {
+
+/**
+ All symbols created by Sym(), keyed by their lower case name.
+ Symbols are never removed, so a Ref to a symbol stays valid. They are
+ kept in a Heap of their own, independent of the current Heap.
+ */
+struct SymbolTable {
+  std::mutex mutex_;
+  std::unordered_map<std::string, Symbol*> map_;
+  Heap heap_;
+  SymbolTable() {
+    map_.reserve(1024);
+    map_.emplace("string", const_cast<Symbol*>(&gSymObjString));
+    map_.emplace("real", const_cast<Symbol*>(&gSymObjReal));
+    map_.emplace("array", const_cast<Symbol*>(&kSymArray));
+  }
+};
+
+SymbolTable &symbol_table() {
+  static SymbolTable table;
+  return table;
+}
+
+} // namespace
+
+/**
+ Return the unique symbol with the given name.
+
+ Symbols are not case sensitive. The first spelling of a symbol that is
+ requested is kept and returned for all later requests, so two symbols are
+ equal if their Refs are equal.
+
+ \param[in] name the symbol text
+ \return a Ref to the global symbol
+ */
+Ref nos::Sym(std::string_view name) {
+  std::string key(name);
+  for (auto &c: key)
+    c = (char)std::tolower((unsigned char)c);
+  SymbolTable &table = symbol_table();
+  std::lock_guard<std::mutex> lock(table.mutex_);
+  auto it = table.map_.find(key);
+  if (it != table.map_.end())
+    return Ref(it->second);
+  Symbol *sym = table.heap_.New<Symbol>(table.heap_.CopyString(name));
+  table.map_.emplace(std::move(key), sym);
+  return Ref(sym);
 }
 
 Ref nos::AllocateBinary(RefArg theClass, Index length)
 {
-  return Ref(new BinaryObject(theClass, length, ::calloc(length, 1)));
+  Heap &heap = Heap::Current();
+  return Ref(heap.New<BinaryObject>(theClass, length, heap.AllocateZeroed((size_t)length)));
 }
 
 Ptr nos::BinaryData(Ref r)
@@ -374,5 +794,5 @@ Ptr nos::BinaryData(Ref r)
 
 Ref nos::MakeReal(Real d)
 {
-  return Ref(new Object(d));
+  return Ref(Heap::Current().New<Object>(d));
 }
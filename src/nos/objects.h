@@ -24,6 +24,7 @@
 #include "nos/ref.h"
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace nos {
@@ -34,10 +35,15 @@ class Array;
 class Frame;
 class Map;
 class Symbol;
+struct MapIndex;
+class Heap;
+class PrintVisitor;
 
 class alignas(uintptr_t) Object
 {
   friend class Ref;
+  friend class HeapCollector;
+  friend class PrintVisitor;
 
 protected:
   enum class Tag: uint8_t {
@@ -187,6 +193,7 @@ public:
   constexpr bool IsFrame() const { return (t.tag_ == Tag::frame); }
   constexpr bool IsSymbol() const { return (t.tag_ == Tag::symbol); }
   constexpr bool IsReadOnly() const { return (f.read_only_ == 1); }
+  void SetReadOnly(bool v) { f.read_only_ = v; }
 
   int SymbolCompare(const Object *other) const;
 
@@ -211,7 +218,10 @@ public:
   : Object { f, num_slots } { }
   Index Length() const;
   void SetLength(Index new_length);
+  void Reserve(Index capacity);
+  void CopySlots(const Ref *values);
   Ref GetSlot(Index i) const;
+  void InsertSlot(Index i, RefArg value);
 };
 
 class Array: public SlottedObject
@@ -225,13 +235,33 @@ public:
   Index AddSlot(RefArg value);
 };
 
+/// The slot tags in the map are sorted.
+constexpr Integer kMapSorted = 1;
+/// The map is used by more than one frame and must not be changed.
+constexpr Integer kMapShared = 2;
+/// The map contains a _proto slot.
+constexpr Integer kMapProto = 4;
+
+/// Maps with more tags than this get a hash index for finding slots.
+constexpr Index kMapIndexThreshold = 16;
+
 class Map: public Array
 {
+  MapIndex *index_ { nullptr };
+  Index FindSorted(RefArg tag, bool &found) const;
 public:
   constexpr Map(Ref obj_class, uint32_t num_slots, const Ref *values)
   : Array{obj_class, num_slots, values } { }
   Map(RefArg theClass);
   Map(RefArg theClass, Index length);
+  Map(const Map &other);
+  Integer Flags() const;
+  void SetFlags(Integer flags);
+  bool IsSorted() const;
+  void VerifySorted();
+  void BuildIndex(Heap &heap);
+  Index FindTag(RefArg tag) const;
+  Index AddTag(RefArg tag);
 };
 
 class Frame: public SlottedObject
@@ -240,6 +270,8 @@ public:
   constexpr Frame(Map *map, uint32_t num_slots, const Ref *values)
   : SlottedObject( Frame_{ map, const_cast<Ref*>(values), 0 }, num_slots) { }
   Frame();
+  Frame(Index capacity);
+  Frame(Map *map, Index length, const Ref *values);
   int Print(PrintState &ps) const;
   void SetSlot(RefArg tag, RefArg value);
   Index AddSlot(RefArg tag);
@@ -250,6 +282,7 @@ class Symbol: public Object
 public:
   constexpr Symbol(const char *symbol)
   : Object( Symbol_{ RefSymbolClass, const_cast<char*>(symbol), _hash(symbol) } ) { }
+  const char *Name() const { return symbol.string_; }
   int Print(PrintState &ps) const;
 };
 
@@ -273,17 +306,24 @@ constexpr Object::Object(Real value)
 
 
 Ref AllocateFrame();
+Ref AllocateFrame(Index capacity);
+Ref AllocateFrame(RefArg map, Index length, const Ref *values);
 void SetFrameSlot(RefArg obj, RefArg slot, RefArg value);
 Ref AllocateArray(RefArg obj_class, Index length);
+Ref AllocateArray(RefArg obj_class, Index length, const Ref *values);
 Ref AllocateArray(Index length);
+Ref AllocateMap(RefArg flags, Index length);
+Ref AllocateMap(RefArg flags, Index length, const Ref *values);
 Index FindOffset(Ref map, Ref tag);
 Index AddArraySlot(RefArg array_ref, RefArg value);
 bool IsReadOnly(RefArg ref);
+void SetReadOnly(RefArg ref);
 Ref GetArraySlot(RefArg array_obj, Index slot);
 Ref MakeString(const char *str);
 inline Ref MakeString(const std::string &str) { return MakeString(str.c_str()); }
-Ref Sym(const char *name);
-inline Ref Sym(const std::string &name) { return Sym(name.c_str()); }
+Ref Sym(std::string_view name);
+inline Ref Sym(const char *name) { return Sym(std::string_view(name)); }
+inline Ref Sym(const std::string &name) { return Sym(std::string_view(name)); }
 
 Ref AllocateBinary(RefArg theClass, Index length);
 Ptr BinaryData(Ref r);
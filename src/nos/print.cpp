@@ -21,20 +21,165 @@
 #include "nos/types.h"
 #include "nos/ref.h"
 
+#include <charconv>
+#include <cerrno>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
 using namespace nos;
 
-PrintState::PrintState(FILE *fout)
-  : out_(fout)
+int FilePrintSink::write(const char *data, size_t size)
+{
+  return (::fwrite(data, 1, size, out_) == size) ? 0 : -1;
+}
+
+int StringPrintSink::write(const char *data, size_t size)
+{
+  out_.append(data, size);
+  return 0;
+}
+
+int FdPrintSink::write(const char *data, size_t size)
+{
+  while (size > 0) {
+#ifdef _WIN32
+    int n = ::_write(fd_, data, (unsigned)size);
+#else
+    ssize_t n = ::write(fd_, data, size);
+#endif
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    data += n;
+    size -= (size_t)n;
+  }
+  return 0;
+}
+
+/** \class PrintState
+ Settings and output buffer for printing NOS objects.
+
+ Printing a large object tree generates many tiny pieces of text. They are
+ collected in a buffer and handed to the sink in large blocks. Numbers are
+ formatted without printf, so no format strings are parsed and no locale is
+ consulted.
+
+ A PrintState has no shared state. Multiple threads can print at the same
+ time if each one uses its own PrintState.
+ */
+
+/**
+ Print to a stdio file.
+ \param[in] fout the file, for example stdout
+ \param[in] flush_size text is written whenever this many bytes were collected
+ */
+PrintState::PrintState(FILE *fout, size_t flush_size)
+  : own_sink_(std::make_unique<FilePrintSink>(fout)),
+    sink_(own_sink_.get()),
+    flush_size_(flush_size)
 {
+  buffer_.reserve(flush_size + 256);
 }
 
+/**
+ Print into a string.
+ \param[in] out text is appended to this string
+ \param[in] flush_size text is appended whenever this many bytes were collected
+ */
+PrintState::PrintState(std::string &out, size_t flush_size)
+  : own_sink_(std::make_unique<StringPrintSink>(out)),
+    sink_(own_sink_.get()),
+    flush_size_(flush_size)
+{
+  buffer_.reserve(flush_size + 256);
+}
+
+/**
+ Print to any sink.
+ \param[in] sink must stay valid for the lifetime of the PrintState
+ \param[in] flush_size text is written whenever this many bytes were collected
+ */
+PrintState::PrintState(PrintSink &sink, size_t flush_size)
+  : sink_(&sink),
+    flush_size_(flush_size)
+{
+  buffer_.reserve(flush_size + 256);
+}
+
+/**
+ Write the remaining text to the sink.
+ */
 PrintState::~PrintState()
 {
+  flush();
+}
+
+/**
+ Write all collected text to the sink.
+ \return 0, or -1 if this or any earlier write failed
+ */
+int PrintState::flush()
+{
+  if (!buffer_.empty()) {
+    if (sink_->write(buffer_.data(), buffer_.size()) < 0)
+      error_ = -1;
+    buffer_.clear();
+  }
+  return error_;
+}
+
+/**
+ Write an integer in decimal.
+ */
+void PrintState::put_int(int64_t v)
+{
+  char buf[24], *end = buf + sizeof(buf), *p = end;
+  uint64_t u = (v < 0) ? (0 - (uint64_t)v) : (uint64_t)v;
+  do {
+    *--p = (char)('0' + (u % 10));
+    u /= 10;
+  } while (u);
+  if (v < 0)
+    *--p = '-';
+  put(std::string_view(p, (size_t)(end - p)));
+}
+
+/**
+ Write an unsigned integer in lower case hexadecimal, with leading zeros up
+ to the given width.
+ */
+void PrintState::put_hex(uint64_t v, int width)
+{
+  static const char digits[] = "0123456789abcdef";
+  char buf[16], *end = buf + sizeof(buf), *p = end;
+  do {
+    *--p = digits[v & 15];
+    v >>= 4;
+  } while (v);
+  int n = (int)(end - p);
+  if (n < width)
+    buffer_.append((size_t)(width - n), '0');
+  put(std::string_view(p, (size_t)n));
+}
+
+/**
+ Write a floating point value in the same format as printf("%g") does.
+ */
+void PrintState::put_real(double v)
+{
+  char buf[32];
+  auto r = std::to_chars(buf, buf + sizeof(buf), v, std::chars_format::general, 6);
+  put(std::string_view(buf, (size_t)(r.ptr - buf)));
 }
 
 void PrintState::tab() {
-  for (uint32_t i=0; i<current_depth_; ++i)
-    fprintf(out_, "  ");
+  buffer_.append((size_t)current_depth_ * 2, ' ');
 }
 
 bool PrintState::more_depth() {
@@ -62,6 +207,6 @@ void nos::Print(RefArg p)
 {
   PrintState state(stdout);
   p.Print(state);
-  fprintf(state.out_, "\n");
+  state.put('\n');
 }
 
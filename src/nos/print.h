@@ -21,32 +21,96 @@
 #define NEWTFMT_NOS_PRINT_H
 
 #include "nos/types.h"
+#include "tools/graph_walker.h"
 
 #include <stdio.h>
 #include <stdint.h>
+#include <memory>
+#include <string>
+#include <string_view>
 //#include <limits>
 
 namespace nos {
 
-class PrintState {
+class SlottedObject;
+
+/**
+ Destination of the text generated by a PrintState.
+ */
+class PrintSink {
 public:
+  virtual ~PrintSink() = default;
+  /// Write a block of text, return 0, or -1 if the text could not be written.
+  virtual int write(const char *data, size_t size) = 0;
+};
+
+/**
+ Send printed text to a stdio file.
+ */
+class FilePrintSink : public PrintSink {
+  FILE *out_{ nullptr };
+public:
+  FilePrintSink(FILE *out) : out_(out) { }
+  int write(const char *data, size_t size) override;
+};
+
+/**
+ Append printed text to a string.
+ */
+class StringPrintSink : public PrintSink {
+  std::string &out_;
+public:
+  StringPrintSink(std::string &out) : out_(out) { }
+  int write(const char *data, size_t size) override;
+};
+
+/**
+ Send printed text to a file descriptor, bypassing stdio.
+ */
+class FdPrintSink : public PrintSink {
+  int fd_{ -1 };
+public:
+  FdPrintSink(int fd) : fd_(fd) { }
+  int write(const char *data, size_t size) override;
+};
+
+class PrintState {
 //  prettyPrint: true,
 //  printDepth: 3,
 //  printLength: nil,
 //  uint32_t print_length_{ std::numeric_limits<uint32_t>::max() };
+  std::unique_ptr<PrintSink> own_sink_{ };
+  PrintSink *sink_{ nullptr };
+  std::string buffer_{ };
+  size_t flush_size_{ 0 };
+  int error_{ 0 };
+  GraphWalker<const SlottedObject*> walker_{ };
+  void flush_if_full() { if (buffer_.size() >= flush_size_) flush(); }
+public:
   uint32_t print_depth_{ 8 };
   uint32_t current_depth_{ 0 };
-  FILE *out_{ nullptr };
   bool sym_next_{ false };
 public:
-  PrintState(FILE *fout);
+  PrintState(FILE *fout, size_t flush_size = 64*1024);
+  PrintState(std::string &out, size_t flush_size = 64*1024);
+  PrintState(PrintSink &sink, size_t flush_size = 64*1024);
   ~PrintState();
+  PrintState(PrintState const& rhs) = delete;
+  PrintState& operator=(PrintState const& rhs) = delete;
+  int flush();
+  int error() const { return error_; }
+  void put(char c) { buffer_.push_back(c); flush_if_full(); }
+  void put(std::string_view s) { buffer_.append(s); flush_if_full(); }
+  void put_int(int64_t v);
+  void put_hex(uint64_t v, int width);
+  void put_real(double v);
   void tab();
   bool more_depth(); // TODO: bad naming
   bool incr_depth(); // TODO: return value not used
   void decr_depth();
   void expect_symbol(bool s) { sym_next_ = s; }
   bool symbol_expected() { return sym_next_; }
+  GraphWalker<const SlottedObject*> &walker() { return walker_; }
 };
 
 } // namespace nos
@@ -60,37 +60,42 @@ int Ref::Print(PrintState &ps) const
       o->Print(ps);
       break;
     case Tag::integer:
-      fprintf(ps.out_, "%ld", (Integer)v.value_);
+      ps.put_int((Integer)v.value_);
       break;
     case Tag::immed:
       switch (i.type_) {
         case Type::unichar:
-          fprintf(ps.out_, "$%s", unicode_to_utf8((UniChar)i.value_).c_str());
+          ps.put('$');
+          ps.put(unicode_to_utf8((UniChar)i.value_));
           break;
         case Type::special:
           if (i.value_==0) {
-            fprintf(ps.out_, "NIL");
+            ps.put("NIL");
           } else {
-            fprintf(ps.out_, "[undefined special: %ld]", i.value_);
+            ps.put("[undefined special: ");
+            ps.put_int(i.value_);
+            ps.put(']');
           }
           break;
         case Type::boolean:
           if (i.value_==1) {
-            fprintf(ps.out_, "TRUE");
+            ps.put("TRUE");
           } else {
-            fprintf(ps.out_, "[undefined boolean: %ld]", i.value_);
+            ps.put("[undefined boolean: ");
+            ps.put_int(i.value_);
+            ps.put(']');
           }
           break;
         case Type::reserved:
-          if (sizeof(t)==4)
-            fprintf(ps.out_, "[reserved: 0x%08lx]", t);
-          else
-            fprintf(ps.out_, "[reserved: 0x%086lx]", t);
+          ps.put("[reserved: 0x");
+          ps.put_hex(t, (int)sizeof(t)*2);
+          ps.put(']');
           break;
       }
       break;
     case Tag::magic:
-      fprintf(ps.out_, "@%ld", v.value_);
+      ps.put('@');
+      ps.put_int(v.value_);
       break;
   }
 
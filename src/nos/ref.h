@@ -124,6 +124,8 @@ public:
   constexpr bool operator==(const Ref &other) const { return t == other.t; }
 
   constexpr bool IsPtr() const { return (v.tag_ == Tag::pointer); }
+  constexpr bool IsInteger() const { return (v.tag_ == Tag::integer); }
+  constexpr Integer GetInteger() const { return IsInteger() ? (Integer)v.value_ : 0; }
 
   bool IsBinary() const;
   bool IsArray() const;
@@ -0,0 +1,199 @@
+/*
+ * newtfmt, working title, a Newton Script file reader and writer
+ * Copyright (C) 2025  Matthias Melcher
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef NEWTFMT_PACKAGE_BYTE_CURSOR_H
+#define NEWTFMT_PACKAGE_BYTE_CURSOR_H
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string_view>
+
+#ifdef _MSC_VER
+#include <stdlib.h>
+#endif
+
+namespace pkg {
+
+/// No error while reading.
+constexpr int kReadOK = 0;
+/// A reader tried to access bytes beyond the end of the data.
+constexpr int kReadOverrun = -2;
+
+/**
+ Swap the bytes in a 16 bit word.
+ */
+inline uint16_t bswap16(uint16_t v) {
+#ifdef _MSC_VER
+  return _byteswap_ushort(v);
+#else
+  return __builtin_bswap16(v);
+#endif
+}
+
+/**
+ Swap the bytes in a 32 bit word.
+ */
+inline uint32_t bswap32(uint32_t v) {
+#ifdef _MSC_VER
+  return _byteswap_ulong(v);
+#else
+  return __builtin_bswap32(v);
+#endif
+}
+
+/**
+ Swap the bytes in a 64 bit word.
+ */
+inline uint64_t bswap64(uint64_t v) {
+#ifdef _MSC_VER
+  return _byteswap_uint64(v);
+#else
+  return __builtin_bswap64(v);
+#endif
+}
+
+/**
+ Read an unaligned 16 bit MSB word.
+ */
+inline uint16_t load_be16(const uint8_t *src) {
+  uint16_t v;
+  ::memcpy(&v, src, sizeof(v));
+  if constexpr (std::endian::native == std::endian::little) v = bswap16(v);
+  return v;
+}
+
+/**
+ Read an unaligned 32 bit MSB word.
+ */
+inline uint32_t load_be32(const uint8_t *src) {
+  uint32_t v;
+  ::memcpy(&v, src, sizeof(v));
+  if constexpr (std::endian::native == std::endian::little) v = bswap32(v);
+  return v;
+}
+
+/**
+ Read an unaligned 64 bit MSB word.
+ */
+inline uint64_t load_be64(const uint8_t *src) {
+  uint64_t v;
+  ::memcpy(&v, src, sizeof(v));
+  if constexpr (std::endian::native == std::endian::little) v = bswap64(v);
+  return v;
+}
+
+/**
+ A bounds checked read position within a block of MSB data.
+
+ Every reader checks once if enough bytes are left. If not, the cursor does
+ not move, the reader returns 0 or an empty view, and the error is latched
+ until clear_error() is called. This allows callers to read a whole record
+ and check error() just once at the end.
+ */
+class ByteCursor
+{
+  std::span<const uint8_t> data_ { };
+  size_t pos_ { 0 };
+  int error_ { kReadOK };
+
+  bool overrun() { error_ = kReadOverrun; return false; }
+
+public:
+  ByteCursor() = default;
+  ByteCursor(std::span<const uint8_t> data, size_t pos = 0)
+  : data_(data), pos_(pos <= data.size() ? pos : data.size()) { }
+
+  size_t size() const { return data_.size(); }
+  size_t tell() const { return pos_; }
+  size_t remaining() const { return data_.size() - pos_; }
+  bool eof() const { return pos_ == data_.size(); }
+  int error() const { return error_; }
+  void clear_error() { error_ = kReadOK; }
+
+  /** Check if n more bytes can be read; latch an error if not. */
+  bool has(size_t n) { return (n <= remaining()) ? true : overrun(); }
+
+  /** Move to an absolute position; positions past the end latch an error. */
+  void seek_set(size_t ix) {
+    if (ix <= data_.size()) pos_ = ix; else overrun();
+  }
+
+  uint8_t get_ubyte() {
+    if (!has(1)) return 0;
+    return data_[pos_++];
+  }
+
+  uint16_t get_ushort() {
+    if (!has(2)) return 0;
+    uint16_t v = load_be16(data_.data() + pos_);
+    pos_ += 2;
+    return v;
+  }
+
+  uint32_t get_uint() {
+    if (!has(4)) return 0;
+    uint32_t v = load_be32(data_.data() + pos_);
+    pos_ += 4;
+    return v;
+  }
+
+  uint64_t get_ulong() {
+    if (!has(8)) return 0;
+    uint64_t v = load_be64(data_.data() + pos_);
+    pos_ += 8;
+    return v;
+  }
+
+  /**
+   Read n 32 bit MSB words into a caller provided buffer.
+   \param[out] dst room for at least n words
+   \param[in] n number of words
+   \return kReadOK, or kReadOverrun if fewer than n words are left
+   */
+  int get_uints(uint32_t *dst, size_t n) {
+    if (!has(n * 4)) return kReadOverrun;
+    const uint8_t *src = data_.data() + pos_;
+    for (size_t i = 0; i < n; ++i, src += 4)
+      dst[i] = load_be32(src);
+    pos_ += n * 4;
+    return kReadOK;
+  }
+
+  std::span<const uint8_t> get_data(size_t n) {
+    if (!has(n)) return { };
+    auto v = data_.subspan(pos_, n);
+    pos_ += n;
+    return v;
+  }
+
+  std::string_view get_cstring(size_t n, bool trailing_nul = true) {
+    // n+1 would wrap for n == SIZE_MAX
+    if (trailing_nul ? (n >= remaining()) : (n > remaining())) { overrun(); return { }; }
+    std::string_view v(reinterpret_cast<const char*>(data_.data() + pos_), n);
+    pos_ += trailing_nul ? n+1 : n;
+    return v;
+  }
+};
+
+} // namespace pkg
+
+#endif // NEWTFMT_PACKAGE_BYTE_CURSOR_H
+
@@ -0,0 +1,106 @@
+/*
+ * newtfmt, working title, a Newton Script file reader and writer
+ * Copyright (C) 2025  Matthias Melcher
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef NEWTFMT_PACKAGE_BYTE_WRITER_H
+#define NEWTFMT_PACKAGE_BYTE_WRITER_H
+
+#include "byte_cursor.h"
+
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace pkg {
+
+/**
+ Write a 16 bit MSB word to unaligned memory.
+ */
+inline void store_be16(uint8_t *dst, uint16_t v) {
+  if constexpr (std::endian::native == std::endian::little) v = bswap16(v);
+  ::memcpy(dst, &v, sizeof(v));
+}
+
+/**
+ Write a 32 bit MSB word to unaligned memory.
+ */
+inline void store_be32(uint8_t *dst, uint32_t v) {
+  if constexpr (std::endian::native == std::endian::little) v = bswap32(v);
+  ::memcpy(dst, &v, sizeof(v));
+}
+
+/**
+ A growing block of MSB data, the counterpart to ByteCursor.
+
+ Data is always appended at the end. Values that are not known until later,
+ like sizes and offsets, can be written as placeholders and patched once
+ they are known.
+ */
+class ByteWriter
+{
+  std::vector<uint8_t> data_ { };
+
+public:
+  ByteWriter() = default;
+
+  void reserve(size_t n) { data_.reserve(n); }
+  size_t tell() const { return data_.size(); }
+  const std::vector<uint8_t> &data() const { return data_; }
+  std::vector<uint8_t> &data() { return data_; }
+
+  void put_ubyte(uint8_t v) { data_.push_back(v); }
+
+  void put_ushort(uint16_t v) {
+    size_t pos = data_.size();
+    data_.resize(pos + 2);
+    store_be16(data_.data() + pos, v);
+  }
+
+  void put_uint(uint32_t v) {
+    size_t pos = data_.size();
+    data_.resize(pos + 4);
+    store_be32(data_.data() + pos, v);
+  }
+
+  void put_data(std::span<const uint8_t> src) {
+    data_.insert(data_.end(), src.begin(), src.end());
+  }
+
+  /** Write n bytes of text, padded with NUL or cropped to fit. */
+  void put_chars(std::string_view s, size_t n) {
+    size_t pos = data_.size();
+    data_.resize(pos + n, 0);
+    ::memcpy(data_.data() + pos, s.data(), (s.size() < n) ? s.size() : n);
+  }
+
+  /** Write n copies of a byte. */
+  void fill(size_t n, uint8_t v) { data_.resize(data_.size() + n, v); }
+
+  /** Fill up to the next multiple of a; a must be a power of two. */
+  void align(size_t a, uint8_t v) { fill((size_t)(-data_.size()) & (a-1), v); }
+
+  void patch_ushort(size_t pos, uint16_t v) { store_be16(data_.data() + pos, v); }
+  void patch_uint(size_t pos, uint32_t v) { store_be32(data_.data() + pos, v); }
+};
+
+} // namespace pkg
+
+#endif // NEWTFMT_PACKAGE_BYTE_WRITER_H
+
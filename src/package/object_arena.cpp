@@ -0,0 +1,59 @@
+/*
+ * newtfmt, working title, a Newton Script file reader and writer
+ * Copyright (C) 2025  Matthias Melcher
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "object_arena.h"
+
+#include <algorithm>
+
+using namespace pkg;
+
+/** \class pkg::ObjectArena
+ Allocate the Objects of a NOS part and their payloads from a few large blocks.
+
+ A part may contain tens of thousands of small objects. Creating each of them
+ on the heap is slow, and so is freeing them again. The arena trades that for
+ a handful of allocations, sized after the part.
+ */
+
+/**
+ Create an empty arena.
+ \param[in] initial_size size of the first block in bytes, or 0 for a default
+ */
+ObjectArena::ObjectArena(size_t initial_size)
+: next_block_size_(std::max(initial_size, (size_t)4096))
+{
+}
+
+/**
+ Start a new block that is large enough for the request.
+ Each new block is twice the size of the previous one.
+ \param[in] size number of bytes
+ \param[in] align alignment, must be a power of two
+ \return pointer to the memory
+ */
+void *ObjectArena::allocateBlock(size_t size, size_t align)
+{
+  size_t block_size = std::max(next_block_size_, size + align);
+  next_block_size_ = block_size * 2;
+  block_list_.push_back(std::make_unique_for_overwrite<uint8_t[]>(block_size));
+  ptr_ = block_list_.back().get();
+  avail_ = block_size;
+  return allocate(size, align);
+}
+
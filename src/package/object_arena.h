@@ -0,0 +1,100 @@
+/*
+ * newtfmt, working title, a Newton Script file reader and writer
+ * Copyright (C) 2025  Matthias Melcher
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef NEWTFMT_PACKAGE_OBJECT_ARENA_H
+#define NEWTFMT_PACKAGE_OBJECT_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace pkg {
+
+/**
+ A monotonic memory pool that owns all objects of a part.
+
+ Memory is handed out from large blocks and never returned individually.
+ All memory is released at once when the arena is destroyed. Destructors of
+ objects created in the arena are not called, so those objects must not own
+ any other resources.
+ */
+class ObjectArena
+{
+  std::vector<std::unique_ptr<uint8_t[]>> block_list_;
+  uint8_t *ptr_ { nullptr };
+  size_t avail_ { 0 };
+  size_t next_block_size_ { 0 };
+
+  void *allocateBlock(size_t size, size_t align);
+
+public:
+  ObjectArena(size_t initial_size = 0);
+  ~ObjectArena() = default;
+  ObjectArena(ObjectArena const& rhs) = delete;
+  ObjectArena& operator=(ObjectArena const& rhs) = delete;
+
+  /**
+   Return a block of uninitialized memory.
+   \param[in] size number of bytes
+   \param[in] align alignment, must be a power of two
+   \return pointer to the memory, valid for the lifetime of the arena
+   */
+  void *allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+    size_t pad = (size_t)(-(uintptr_t)ptr_) & (align - 1);
+    if (pad + size > avail_)
+      return allocateBlock(size, align);
+    uint8_t *p = ptr_ + pad;
+    ptr_ = p + size;
+    avail_ -= pad + size;
+    return p;
+  }
+
+  /** Construct an object of type T in the arena. */
+  template<class T, class... Args>
+  T *create(Args&&... args) {
+    return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+  }
+
+  /** Allocate an array of n zero initialized words. */
+  std::span<uint32_t> allocateWords(size_t n) {
+    if (n == 0) return { };
+    uint32_t *p = static_cast<uint32_t*>(allocate(n * sizeof(uint32_t), alignof(uint32_t)));
+    ::memset(p, 0, n * sizeof(uint32_t));
+    return { p, n };
+  }
+
+  /** Copy a string into the arena. */
+  std::string_view copyString(std::string_view s) {
+    if (s.empty()) return { };
+    char *p = static_cast<char*>(allocate(s.size(), 1));
+    ::memcpy(p, s.data(), s.size());
+    return { p, s.size() };
+  }
+};
+
+} // namespace pkg
+
+#endif // NEWTFMT_PACKAGE_OBJECT_ARENA_H
+
@@ -0,0 +1,204 @@
+/*
+ * newtfmt, working title, a Newton Script file reader and writer
+ * Copyright (C) 2025  Matthias Melcher
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "object_store.h"
+
+#include "part_data.h"
+
+#include "nos/objects.h"
+#include "nos/heap.h"
+
+#include <iostream>
+
+using namespace pkg;
+
+/** \class pkg::ObjectStore
+ A content addressed store of converted objects, shared by many packages.
+
+ Packages that were built with the same tools contain many identical
+ objects: symbols, protos, bitmaps, and byte code. When a package is
+ converted with a store, every object is looked up by its content hash,
+ see PartDataNOS::hashObjects(). If the same object was converted before,
+ possibly from another package, the NOS object from the store is used
+ instead of converting it again.
+
+ The NOS objects in the store are shared by all trees that were converted
+ with it, so they are marked read-only. They are created in Heaps that
+ belong to the store, one for every thread that converts packages. Objects
+ that are not in the store, like copies that lost the race against another
+ thread, are released by maybeCollect().
+
+ All methods can be called from multiple threads.
+ */
+
+ObjectStore::ObjectStore()
+: collected_heap_(std::make_unique<nos::Heap>())
+{ }
+
+ObjectStore::~ObjectStore() = default;
+
+/**
+ Count an object that was converted with a store.
+ \param[in] obj the object in the package
+ \param[in] duplicate true if the object was taken from the store
+ */
+void ObjectStoreReport::count(const Object &obj, bool duplicate)
+{
+  ObjectStoreStats &s = obj.isSymbol() ? symbol_ : ((obj.type() == 0) ? binary_ : slotted_);
+  s.objects_++;
+  s.bytes_ += obj.binarySize();
+  if (duplicate) {
+    s.duplicates_++;
+    s.bytes_saved_ += obj.binarySize();
+  }
+}
+
+/**
+ Add the numbers of another report to this one.
+ */
+void ObjectStoreReport::merge(const ObjectStoreReport &other)
+{
+  auto add = [](ObjectStoreStats &a, const ObjectStoreStats &b) {
+    a.objects_ += b.objects_;
+    a.duplicates_ += b.duplicates_;
+    a.bytes_ += b.bytes_;
+    a.bytes_saved_ += b.bytes_saved_;
+  };
+  add(binary_, other.binary_);
+  add(symbol_, other.symbol_);
+  add(slotted_, other.slotted_);
+}
+
+/**
+ Return the Heap of the calling thread for creating objects in the store.
+ \return a Heap that lives as long as the store
+ */
+nos::Heap &ObjectStore::heap()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto &heap = heap_list_[std::this_thread::get_id()];
+  if (!heap)
+    heap = std::make_unique<nos::Heap>(1024*1024);
+  return *heap;
+}
+
+/**
+ Find an object that was converted before.
+ \param[in] hash content hash of the object
+ \param[out] nos_object the converted object, if found
+ \return true if the object was found
+ */
+bool ObjectStore::find(const ContentHash &hash, nos::Ref &nos_object)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = map_.find(hash);
+  if (it == map_.end())
+    return false;
+  nos_object = it->second.nos_object_;
+  return true;
+}
+
+/**
+ Add a converted object to the store.
+
+ If another thread added an object with the same hash in the meantime, that
+ object is returned instead, so that all trees share the same one.
+
+ \param[in] hash content hash of the object
+ \param[in] obj the object in the package
+ \param[in] nos_object the converted object, created in heap()
+ \return the object in the store
+ */
+nos::Ref ObjectStore::insert(const ContentHash &hash, const Object &obj, nos::Ref nos_object)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto [it, inserted] = map_.try_emplace(hash, Entry { nos_object });
+  if (!inserted)
+    return it->second.nos_object_;
+  if (nos_object.IsPtr() && !nos_object.IsSymbol()) {
+    // Frames that use a map from the store must copy it before adding slots
+    if (obj.isMap()) {
+      nos::Map *map = static_cast<nos::Map*>(nos_object.GetObject());
+      map->SetFlags(map->Flags() | nos::kMapShared);
+    }
+    nos::SetReadOnly(nos_object);
+    // Entries are never removed, and their address does not change
+    collected_heap_->AddRoot(&it->second.nos_object_);
+  }
+  return nos_object;
+}
+
+/**
+ Release objects that are no longer in the store.
+
+ The Heaps of all threads are moved into one Heap, which is collected if
+ enough memory was allocated since the last collection. All objects in the
+ store are moved, so this must only be called when no package is being
+ converted with the store, and no tree that was converted with it is used
+ anymore.
+
+ \return true if a collection was run
+ */
+bool ObjectStore::maybeCollect()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto &heap: heap_list_)
+    collected_heap_->Adopt(*heap.second);
+  return collected_heap_->MaybeCollect();
+}
+
+/**
+ Add the statistics of a conversion to the statistics of the store.
+ \param[in] report objects that were converted and objects that were reused
+ */
+void ObjectStore::addReport(const ObjectStoreReport &report)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  report_.merge(report);
+}
+
+/**
+ Number of unique objects in the store.
+ */
+size_t ObjectStore::size()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  return map_.size();
+}
+
+/**
+ Print how many duplicate objects were found, and how many bytes they use in
+ their packages.
+ */
+void ObjectStore::printStats()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto print = [](const char *kind, const ObjectStoreStats &s) {
+    std::cout << kind << s.objects_ << " objects, " << s.duplicates_ << " duplicates, "
+    << s.bytes_saved_ << " of " << s.bytes_ << " bytes saved." << std::endl;
+  };
+  std::cout << "Object store: " << map_.size() << " unique objects." << std::endl;
+  print("  Binaries: ", report_.binary_);
+  print("  Symbols:  ", report_.symbol_);
+  print("  Slotted:  ", report_.slotted_);
+  const nos::HeapStats &heap = collected_heap_->Stats();
+  std::cout << "  Heap:     " << heap.collections_ << " collections, "
+  << heap.bytes_live_ << " bytes live, " << heap.bytes_freed_ << " bytes freed." << std::endl;
+}
+
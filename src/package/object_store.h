@@ -0,0 +1,97 @@
+/*
+ * newtfmt, working title, a Newton Script file reader and writer
+ * Copyright (C) 2025  Matthias Melcher
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef NEWTFMT_PACKAGE_OBJECT_STORE_H
+#define NEWTFMT_PACKAGE_OBJECT_STORE_H
+
+#include "tools/content_hash.h"
+#include "nos/ref.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace nos {
+class Heap;
+}
+
+namespace pkg {
+
+class Object;
+
+/**
+ Number of objects and bytes of one kind of object in an ObjectStore.
+ */
+struct ObjectStoreStats {
+  /// Number of objects that were looked up in the store.
+  size_t objects_ { 0 };
+  /// Number of objects that were already in the store.
+  size_t duplicates_ { 0 };
+  /// Size of all objects in their packages.
+  size_t bytes_ { 0 };
+  /// Size of the objects that were already in the store.
+  size_t bytes_saved_ { 0 };
+};
+
+/**
+ Statistics of an ObjectStore, split by the kind of object.
+ */
+struct ObjectStoreReport {
+  ObjectStoreStats binary_;
+  ObjectStoreStats symbol_;
+  ObjectStoreStats slotted_;
+  void count(const Object &obj, bool duplicate);
+  void merge(const ObjectStoreReport &other);
+};
+
+class ObjectStore
+{
+  struct Entry {
+    nos::Ref nos_object_;
+  };
+
+  std::mutex mutex_;
+  std::unordered_map<ContentHash, Entry, ContentHashKey> map_;
+  std::map<std::thread::id, std::unique_ptr<nos::Heap>> heap_list_;
+  std::unique_ptr<nos::Heap> collected_heap_;
+  ObjectStoreReport report_;
+
+public:
+  ObjectStore();
+  ~ObjectStore();
+  ObjectStore(ObjectStore const& rhs) = delete;
+  ObjectStore& operator=(ObjectStore const& rhs) = delete;
+
+  nos::Heap &heap();
+  bool find(const ContentHash &hash, nos::Ref &nos_object);
+  nos::Ref insert(const ContentHash &hash, const Object &obj, nos::Ref nos_object);
+  void addReport(const ObjectStoreReport &report);
+  bool maybeCollect();
+  size_t size();
+  void printStats();
+};
+
+} // namespace pkg
+
+#endif // NEWTFMT_PACKAGE_OBJECT_STORE_H
+
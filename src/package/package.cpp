@@ -20,25 +20,84 @@
 #include "package.h"
 
 #include "package_bytes.h"
+#include "byte_writer.h"
 #include "part_entry.h"
 #include "tools/tools.h"
+#include "tools/asm_writer.h"
+#include "tools/thread_pool.h"
 
 #include "nos/objects.h"
+#include "nos/heap.h"
 
 #include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <latch>
+
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace pkg;
 
+/**
+ Find the first and the last byte that differ between two blocks of data.
+
+ Identical data is the common case, so both blocks are compared in large
+ chunks with memcmp() first, and only the chunks that differ are searched
+ byte by byte. If one block is longer, all of its extra bytes differ.
+
+ \param[in] a, b the data to compare
+ \param[out] first offset of the first byte that differs
+ \param[out] last offset after the last byte that differs
+ \return true if the blocks differ
+ */
+static bool findDifference(std::span<const uint8_t> a, std::span<const uint8_t> b, size_t &first, size_t &last)
+{
+  constexpr size_t kChunk = 4096;
+  size_t n = std::min(a.size(), b.size());
+  size_t lo = 0;
+  while ((lo < n) && (::memcmp(a.data() + lo, b.data() + lo, std::min(kChunk, n - lo)) == 0))
+    lo += kChunk;
+  if (lo >= n) {
+    if (a.size() == b.size())
+      return false;
+    first = n;
+    last = std::max(a.size(), b.size());
+    return true;
+  }
+  while (a[lo] == b[lo])
+    ++lo;
+  first = lo;
+  if (a.size() != b.size()) {
+    last = std::max(a.size(), b.size());
+    return true;
+  }
+  size_t hi = n;
+  while ((hi - lo > kChunk) && (::memcmp(a.data() + hi - kChunk, b.data() + hi - kChunk, kChunk) == 0))
+    hi -= kChunk;
+  while (a[hi-1] == b[hi-1])
+    --hi;
+  last = hi;
+  return true;
+}
+
 /** \class pkg::Package
  Read, store, and write the binary data in NewtonScript Package format.
  */
 
 /**
  Load the entire package and store the content in memory.
- \param[in] p package data stream
+ \param[in] load_flags if kLoadLazy is set, part data is loaded on first access;
+      kLoadIndexOnly is handed on to the parts
+ \param[in] pool if set, large parts are decoded on this thread pool
  \return 0 if succeeded
  */
-int Package::load() {
+int Package::load(uint32_t load_flags, ThreadPool *pool) {
   if (!pkg_bytes_) {
     std::cout << "ERROR: package bytes not initialized.\n";
     return -1;
@@ -113,15 +172,28 @@ int Package::load() {
   info_ = pkg_bytes_->get_data(info_length_);
 //  std::string info((char*)&info_[0], info_length_);
 //  std::cout << "PackageInfo: " << info << std::endl;
+  if (pkg_bytes_->error()) {
+    std::cout << "ERROR: package directory reaches beyond the end of the file.\n";
+    return -1;
+  }
 
   // Relocation Data if kRelocationFlag is set
   if (flags_ & 0x04000000) {
-    relocation_data_.load(*pkg_bytes_);
+    if (relocation_data_.load(*pkg_bytes_) != 0)
+      return -1;
 //    std::cout << "WARNING: Relocation Data not supported." << std::endl;
   }
 
   // Part Data
-  for (auto &part: part_) part->loadPartData(*pkg_bytes_);
+  part_data_start_ = pkg_bytes_->tell();
+  if (load_flags & kLoadLazy) {
+    for (auto &part: part_) part->deferPartData(pkg_bytes_, part_data_start_, load_flags);
+    return 0;
+  }
+  for (auto &part: part_) {
+    if (part->loadPartData(*pkg_bytes_, load_flags, pool) != 0)
+      return -1;
+  }
 
   return 0;
 }
@@ -130,32 +202,31 @@ int Package::load() {
  Write the Package in ARM32 assembler format.
  \todo The output is not yet symbolic. Absolute values are used
  \param[in] f output stream
- \return number of bytes written
+ \param[in] pool render the parts on this thread pool, may be nullptr
+ \return number of bytes written, or -1 if a part could not be written
  */
-int Package::writeAsm(std::ofstream &f) {
-  f << "@ ===== Package Header" << std::endl;
+int Package::writeAsm(AsmWriter &f, ThreadPool *pool) {
+  f << "@ ===== Package Header\n";
   f << "\t.ascii\t\"" << signature_ << "\"\t@ signature\n";
   f << "\t.ascii\t\"" << type_ << "\"\t@ type\n";
-  f << "\t.int\t0x" << std::setw(8) << std::setfill('0') << std::hex << flags_ << std::dec << "\t@ flags\n";
+  f << "\t.int\t0x" << AsmHex(flags_, 8) << "\t@ flags\n";
   if (flags_ & 0xf0000000) {
     f << "\t\t@";
     if (flags_ & 0x80000000) f << " kAutoRemoveFlag";
     if (flags_ & 0x40000000) f << " kCopyProtectFlag";
     if (flags_ & 0x20000000) f << " kInvisibleFlag";
     if (flags_ & 0x10000000) f << " kNoCompressionFlag";
-    f << std::endl;
+    f << '\n';
   }
   if (flags_ & 0x07000000) {
     f << "\t\t@";
     if (flags_ & 0x04000000) f << " kRelocationFlag";
     if (flags_ & 0x02000000) f << " kUseFasterCompressionFlag";
     if (flags_ & 0x01000000) f << " kWatsonSignaturePresentFlag";
-    f << std::endl;
+    f << '\n';
   }
   if (flags_ & 0x09ffffff)
-    f << "\t@ WARNING unknown flag: "
-    << std::setw(4) << std::setfill('0') << std::hex
-    << (flags_ & 0x09ffffff) << std::dec << std::endl;
+    f << "\t@ WARNING unknown flag: " << AsmHex(flags_ & 0x09ffffff, 4) << '\n';
   f << "\t.int\t" << version_ << "\t@ version\n";
   //  f << "\t.short\t" << copyright_start_ << ", " << copyright_length_ << "\t@ copyright\n";
   f << "\t.short\tpkg_copyright_start-pkg_data, pkg_copyright_end-pkg_copyright_start\t@ copyright\n";
@@ -166,46 +237,46 @@ int Package::writeAsm(std::ofstream &f) {
 #else
   f << "\t.int\tpackage_end-package_start\t@ size\n";
 #endif
-  f << "\t.int\t0x" << std::setw(8) << std::hex << date_ << std::dec << "\t@ date\n";
-  f << "\t.int\t0x" << std::setw(8) << std::hex << reserved2_ << std::dec << "\t@ reserverd2\n";
-  f << "\t.int\t0x" << std::setw(8) << std::hex << reserved3_ << std::dec << "\t@ reserverd3\n";
+  f << "\t.int\t0x" << AsmHex(date_, 8) << "\t@ date\n";
+  f << "\t.int\t0x" << AsmHex(reserved2_, 8) << "\t@ reserverd2\n";
+  f << "\t.int\t0x" << AsmHex(reserved3_, 8) << "\t@ reserverd3\n";
 #if 0
   f << "\t.int\t" << directory_size_ << "\t@ directory_size\n";
 #else
   f << "\t.int\tdirectory_size\t@ directory_size\n";
 #endif
   f << "\t.int\t" << num_parts_ << "\t@ num_parts\n";
-  f << std::endl;
+  f << '\n';
   int bytes = 52;
   for (int i = 0; i < (int)num_parts_; ++i) {
     bytes += part_[i]->writeAsm(f);
   }
-  f << "@ ===== Copyright" << std::endl;
-  f << "pkg_data:" << std::endl << std::endl;
+  f << "@ ===== Copyright\n";
+  f << "pkg_data:\n\n";
 
-  f << "@ ----- Copyright" << std::endl;
-  f << "pkg_copyright_start:" << std::endl;
+  f << "@ ----- Copyright\n";
+  f << "pkg_copyright_start:\n";
   if (copyright_length_)
     bytes += write_utf16(f, copyright_);
-  f << "pkg_copyright_end:" << std::endl << std::endl;
+  f << "pkg_copyright_end:\n\n";
 
-  f << "@ ----- Name" << std::endl;
-  f << "pkg_name_start:" << std::endl;
+  f << "@ ----- Name\n";
+  f << "pkg_name_start:\n";
   if (name_length_)
     bytes += write_utf16(f, name_);
-  f << "pkg_name_end:" << std::endl << std::endl;
+  f << "pkg_name_end:\n\n";
 
   for (auto &part: part_) bytes += part->writeAsmInfo(f);
 
   if (info_.size() > 0) {
-    f << "@ ----- Package Info" << std::endl;
+    f << "@ ----- Package Info\n";
     bytes += write_data(f, info_);
-    f << std::endl;
+    f << '\n';
   }
 
-  f << "\t.balign\t4, 0xff" << std::endl << std::endl;
+  f << "\t.balign\t4, 0xff\n\n";
 
-  f << "directory_size:" << std::endl << std::endl;
+  f << "directory_size:\n\n";
 
 
   // Relocation Data if kRelocationFlag is set
@@ -213,21 +284,163 @@ int Package::writeAsm(std::ofstream &f) {
     bytes += relocation_data_.writeAsm(f);
   }
 
-  f << "@ ===== Package Parts" << std::endl << std::endl;
+  f << "@ ===== Package Parts\n\n";
 
-  for (auto &part: part_) bytes += part->writeAsmPartData(f);
+  int part_bytes = writeAsmParts(f, pool);
+  if (part_bytes < 0)
+    return -1;
+  bytes += part_bytes;
 
-  f << "@ ===== Package End" << std::endl;
+  f << "@ ===== Package End\n";
 
   return bytes;
 }
 
+/**
+ Append a string as UTF-16 MSB text with a trailing NUL.
+ \param[in] w append the data here
+ \param[in] u8str UTF-8 encoded text
+ \return number of bytes written
+ */
+static int put_utf16(ByteWriter &w, std::string &u8str) {
+  auto str16 = utf8_to_utf16(u8str);
+  for (auto c: str16)
+    w.put_ushort((uint16_t)c);
+  w.put_ushort(0);
+  return ((int)str16.size()+1) * 2;
+}
+
+/**
+ Write the Package in binary package format.
+
+ This creates the same data as assembling the output of writeAsm(). Offsets
+ and sizes are calculated from the data that is actually written.
+
+ \param[in] w append the data here
+ \return 0 if successful, -1 if a part could not be written
+ */
+int Package::writeBinary(ByteWriter &w) {
+  w.put_chars(signature_, 8);
+  w.put_chars(type_, 4);
+  w.put_uint(flags_);
+  w.put_uint(version_);
+  w.put_uint(0);              // copyright
+  w.put_uint(0);              // name
+  w.put_uint(0);              // size
+  w.put_uint(date_);
+  w.put_uint(reserved2_);
+  w.put_uint(reserved3_);
+  w.put_uint(0);              // directory_size
+  w.put_uint(num_parts_);
+  for (int i = 0; i < (int)num_parts_; ++i) {
+    part_[i]->writeBinary(w);
+  }
+
+  size_t vdata_start = w.tell();
+  size_t copyright_start = w.tell();
+  if (copyright_length_)
+    put_utf16(w, copyright_);
+  w.patch_ushort(20, (uint16_t)(copyright_start - vdata_start));
+  w.patch_ushort(22, (uint16_t)(w.tell() - copyright_start));
+
+  size_t name_start = w.tell();
+  if (name_length_)
+    put_utf16(w, name_);
+  w.patch_ushort(24, (uint16_t)(name_start - vdata_start));
+  w.patch_ushort(26, (uint16_t)(w.tell() - name_start));
+
+  for (auto &part: part_) part->writeBinaryInfo(w, vdata_start);
+
+  w.put_data(info_);
+  w.align(4, 0xff);
+  w.patch_uint(44, (uint32_t)w.tell());
+
+  // Relocation Data if kRelocationFlag is set
+  if (flags_ & 0x04000000) {
+    relocation_data_.writeBinary(w);
+  }
+
+  size_t part_data_start = w.tell();
+  for (auto &part: part_) {
+    if (part->writeBinaryPartData(w, part_data_start) < 0)
+      return -1;
+  }
+
+  w.patch_uint(28, (uint32_t)w.tell());
+  return 0;
+}
+
+/**
+ Write the data of all parts in ARM32 assembler format.
+
+ Parts don't depend on each other, so if a thread pool is given, every part
+ is rendered into its own buffer by a worker thread. The buffers are then
+ written in directory order, so the output is the same as without a pool.
+
+ \param[in] f output stream
+ \param[in] pool run on this thread pool, or nullptr to write all parts
+      sequentially on the calling thread; must not be called from a task
+      running in the same pool
+ \return number of bytes written, or -1 if any part could not be written
+ */
+int Package::writeAsmParts(AsmWriter &f, ThreadPool *pool) {
+  int bytes = 0;
+  size_t n = part_.size();
+  if (!pool || n < 2) {
+    for (auto &part: part_) {
+      int part_bytes = part->writeAsmPartData(f);
+      if (part_bytes < 0)
+        return -1;
+      bytes += part_bytes;
+    }
+    return bytes;
+  }
+
+  // Lazy loading shares the read position in the package data, so all part
+  // data is loaded here before the workers start.
+  for (auto &part: part_) part->partData();
+
+  std::vector<std::unique_ptr<AsmWriter>> part_asm(n);
+  std::vector<int> part_bytes(n, 0);
+  std::latch done((std::ptrdiff_t)n);
+  for (size_t i = 0; i < n; ++i) {
+    // Start small, the buffer grows with the text
+    part_asm[i] = std::make_unique<AsmWriter>();
+    pool->submit([this, &part_asm, &part_bytes, &done, i]() {
+      LatchGuard guard(done);
+      // Tasks must not throw, for example when the writer runs out of memory
+      try {
+        part_bytes[i] = part_[i]->writeAsmPartData(*part_asm[i]);
+      } catch (std::exception &e) {
+        std::cout << "ERROR: writeAsm: Part " << i << ": exception: " << e.what() << std::endl;
+        part_bytes[i] = -1;
+      }
+    });
+  }
+  done.wait();
+
+  for (size_t i = 0; i < n; ++i) {
+    if (part_bytes[i] < 0)
+      return -1;
+    f << part_asm[i]->view();
+    part_asm[i] = nullptr;
+    bytes += part_bytes[i];
+  }
+  return bytes;
+}
+
 /**
  Compare the package with the other package.
+
+ If the caller knows that the package files differ only in a range of bytes,
+ parts that are at the same position in both packages and outside of that
+ range are not compared.
+
  \param[in] other the other package
+ \param[in] first, last range of package offsets that may differ
  \return 0 if they are the same.
  */
-int Package::compare(Package &other) {
+int Package::compare(Package &other, uint32_t first, uint32_t last) {
   int ret = 0;
   if (signature_ != other.signature_) {
     std::cout << "WARNING: Package signatures differ!" << std::endl;
@@ -266,29 +479,180 @@ int Package::compare(Package &other) {
     return -1;
   }
   for (size_t i=0; i<part_.size(); ++i) {
-    ret = part_[i]->compare(*other.part_[i]);
+    PartEntry &part = *part_[i];
+    PartEntry &other_part = *other.part_[i];
+    uint32_t start = part_data_start_ + part.offset();
+    uint32_t end = start + (uint32_t)part.size();
+    if ((part_data_start_ == other.part_data_start_) && (part.offset() == other_part.offset())
+        && (part.size() == other_part.size()) && ((end <= first) || (start >= last)))
+      continue;
+    ret = part.compare(other_part, first, last);
     if (ret != 0) break;
   }
   return ret;
 }
 
 
+/**
+ Read a block of bytes from a given position in a file, or find the size
+ of the file.
+ \return 0 if all bytes were read
+ */
+#ifdef _WIN32
+static int read_at(std::ifstream &f, uint8_t *dst, size_t n, size_t pos) {
+  f.seekg((std::streamoff)pos);
+  return f.read(reinterpret_cast<char*>(dst), (std::streamsize)n) ? 0 : -1;
+}
+static size_t file_size(std::ifstream &f) {
+  f.seekg(0, std::ios::end);
+  std::streamoff n = f.tellg();
+  return (n < 0) ? 0 : (size_t)n;
+}
+#else
+static int read_at(int fd, uint8_t *dst, size_t n, size_t pos) {
+  while (n > 0) {
+    ssize_t r = ::pread(fd, dst, n, (off_t)pos);
+    if (r <= 0) return -1;
+    dst += r; pos += (size_t)r; n -= (size_t)r;
+  }
+  return 0;
+}
+static size_t file_size(int fd) {
+  struct stat st;
+  if ((::fstat(fd, &st) != 0) || (st.st_size < 0))
+    return 0;
+  return (size_t)st.st_size;
+}
+#endif
+
+/**
+ Read the package header and part directory without loading the package.
+
+ This reads the 52 byte header and then the rest of the directory, including
+ the name and copyright strings, and nothing else. No part data or relocation
+ data is read or allocated. It is meant for quickly indexing large numbers of
+ package files.
+
+ \param[in] package_file_name path and name
+ \param[out] summary receives the header and directory information
+ \return 0 if successful, -1 if the file can't be read or is not a package
+ */
+int Package::scanHeader(const std::string &package_file_name, PackageSummary &summary)
+{
+  constexpr size_t kHeaderSize = 52;
+  constexpr size_t kPartEntrySize = 32;
+  uint8_t header[kHeaderSize];
+  std::vector<uint8_t> directory;
+
+#ifdef _WIN32
+  std::ifstream fd { package_file_name, std::ios::binary };
+  if (!fd)
+    return -1;
+#else
+  int fd = ::open(package_file_name.c_str(), O_RDONLY);
+  if (fd == -1)
+    return -1;
+#endif
+
+  int ret = -1;
+  do {
+    if (read_at(fd, header, kHeaderSize, 0) != 0)
+      break;
+    ByteCursor h(std::span<const uint8_t>(header, kHeaderSize));
+    summary.signature_ = h.get_cstring(8, false);
+    if ((summary.signature_ != "package0") && (summary.signature_ != "package1"))
+      break;
+    summary.type_ = h.get_cstring(4, false);
+    summary.flags_ = h.get_uint();
+    summary.version_ = h.get_uint();
+    uint16_t copyright_start = h.get_ushort();
+    uint16_t copyright_length = h.get_ushort();
+    uint16_t name_start = h.get_ushort();
+    uint16_t name_length = h.get_ushort();
+    summary.size_ = h.get_uint();
+    summary.date_ = h.get_uint();
+    h.get_uint(); // reserved2
+    h.get_uint(); // reserved3
+    uint32_t directory_size = h.get_uint();
+    uint32_t num_parts = h.get_uint();
+    size_t vdata_start = kHeaderSize + num_parts * kPartEntrySize;
+    if ((directory_size < vdata_start) || (directory_size > summary.size_))
+      break;
+    // Don't trust the header before allocating the directory
+    if (directory_size > file_size(fd))
+      break;
+
+    directory.resize(directory_size - kHeaderSize);
+    if (read_at(fd, directory.data(), directory.size(), kHeaderSize) != 0)
+      break;
+    ByteCursor d(directory);
+    summary.part_.resize(num_parts);
+    for (auto &part: summary.part_) {
+      d.get_uint(); // offset
+      part.size_ = d.get_uint();
+      d.get_uint(); // size2
+      part.type_ = d.get_cstring(4, false);
+      d.get_uint(); // reserved
+      part.flags_ = d.get_uint();
+      d.seek_set(d.tell() + 8); // info and compressor
+    }
+
+    auto ustring = [&](uint16_t start, uint16_t length) {
+      std::u16string s;
+      ByteCursor u(directory, vdata_start - kHeaderSize + start);
+      for (int i = 0; i < length/2-1; ++i) {
+        char16_t c = (char16_t)u.get_ushort();
+        if (c == 0) break;
+        s += c;
+      }
+      return utf16_to_utf8(s);
+    };
+    summary.copyright_ = copyright_length ? ustring(copyright_start, copyright_length) : std::string();
+    summary.name_ = name_length ? ustring(name_start, name_length) : std::string();
+    if (d.error() == kReadOK)
+      ret = 0;
+  } while (0);
+
+#ifndef _WIN32
+  ::close(fd);
+#endif
+  return ret;
+}
+
 /**
  Load a Package file and read the internal data representation.
+
+ With kLoadMapped, the file is mapped into memory and all strings and data
+ blocks in the Package refer directly to the mapped pages. Otherwise, the
+ file is read into a buffer that is owned by the Package.
+
+ With kLoadLazy, only the header, the part directory, and the relocation data
+ are read. The data of each part is loaded by PartEntry::partData() when it
+ is first needed.
+
+ With kLoadIndexOnly, NOS parts only record where each object is. An object
+ is decoded when it is first accessed, which saves time and memory if only a
+ few objects of a large package are needed.
+
  \param[in] package_file_name path and name
+ \param[in] load_flags any combination of kLoadMapped, kLoadLazy, and
+      kLoadIndexOnly
+ \param[in] pool if set, large parts are decoded on this thread pool; parts
+      that are loaded lazily are always decoded on the calling thread
  \return 0 if successful
  */
-int Package::load(const std::string &package_file_name)
+int Package::load(const std::string &package_file_name, uint32_t load_flags, ThreadPool *pool)
 {
   file_name_ = package_file_name;
-  std::ifstream source_file { package_file_name, std::ios::binary };
-  if (source_file) {
-    pkg_bytes_ = std::make_shared<PackageBytes>();
-    pkg_bytes_->assign(std::istreambuf_iterator<char>{source_file}, {});
-    file_name_ = package_file_name;
+  pkg_bytes_ = std::make_shared<PackageBytes>();
+  int err = (load_flags & kLoadMapped)
+          ? pkg_bytes_->map(package_file_name)
+          : pkg_bytes_->read(package_file_name);
+  if (err == 0) {
 //    std::cout << "readPackage: \"" << file_name_ << "\" package read (" << pkg_bytes_->size() << " bytes)." << std::endl;
-    return load();
+    return load(load_flags, pool);
   }
+  pkg_bytes_ = nullptr;
   std::cout << "readPackage: Unable to read file \"" << package_file_name << "\"." << std::endl;
   return -1;
 }
@@ -297,19 +661,21 @@ int Package::load(const std::string &package_file_name)
 /**
  Write a Package as an ARM32 assembler file.
  \param[in] assembler_file_name path and name
+ \param[in] pool if set, render the parts in parallel on this thread pool
  \return 0 if successful
  */
-int Package::writeAsm(const std::string &assembler_file_name)
+int Package::writeAsm(const std::string &assembler_file_name, ThreadPool *pool)
 {
-  std::ofstream asm_file { assembler_file_name };
-  if (asm_file.fail()) {
+  std::ofstream out_file { assembler_file_name };
+  if (out_file.fail()) {
     std::cout << "writeAsm: Unable to write assembler file \"" << assembler_file_name << "\"." << std::endl;
     return -1;
   }
+  AsmWriter asm_file { out_file };
 
-  asm_file << "@" << std::endl;
-  asm_file << "@ Assembler file generated from Newton Package" << std::endl;
-  asm_file << "@" << std::endl << std::endl;
+  asm_file << "@\n";
+  asm_file << "@ Assembler file generated from Newton Package\n";
+  asm_file << "@\n\n";
 
   asm_file << "\t.macro\tref_magic index\n"
   << "\t.int\t((\\index)<<2)|3\n"
@@ -352,76 +718,180 @@ int Package::writeAsm(const std::string &assembler_file_name)
 //  << "\t.space\t . & 0x0f, 0xbf\n"
 //  << "\t.endm\n\n";
 
-  asm_file << "\t.file\t\"" << file_name_ << "\"" << std::endl;
-  asm_file << "\t.data" << std::endl;
-  asm_file << "package_start:" << std::endl << std::endl;
+  asm_file << "\t.file\t\"" << file_name_ << "\"\n";
+  asm_file << "\t.data\n";
+  asm_file << "package_start:\n\n";
 
-  int skip = writeAsm(asm_file);
-  asm_file << "package_end:" << std::endl << std::endl;
+  int skip = writeAsm(asm_file, pool);
+  if (skip < 0) {
+    std::cout << "writeAsm: Unable to write the parts of the package to \"" << assembler_file_name << "\"." << std::endl;
+    return -1;
+  }
+  asm_file << "package_end:\n\n";
 
   if (skip < (int)pkg_bytes_->size()) {
     std::cout << "WARNING: Package has " << pkg_bytes_->size()-skip << " more bytes than defined." << std::endl;
-    asm_file << "@ ===== Extra data in file" << std::endl;
+    asm_file << "@ ===== Extra data in file\n";
     for (auto it = pkg_bytes_->begin()+skip; it != pkg_bytes_->end(); ++it) {
       uint8_t b = *it;
-      asm_file << "\t.byte\t0x"
-      << std::setw(2) << std::setfill('0') << std::hex << (int)b
-      << "\t@ " << (char)( ((b > 32) && (b < 127)) ? b : '.' )
-      << std::endl;
+      asm_file << "\t.byte\t0x" << AsmHex(b, 2)
+      << "\t@ " << (char)( ((b > 32) && (b < 127)) ? b : '.' ) << '\n';
     }
   }
 
+  asm_file.flush();
+  if (out_file.fail()) {
+    std::cout << "writeAsm: Error writing assembler file \"" << assembler_file_name << "\"." << std::endl;
+    return -1;
+  }
   return 0;
 }
 
+/**
+ List the objects that differ between this package and another version.
+
+ Objects are matched by their content, so unlike compare(), an object that
+ was inserted or removed does not make all following objects differ.
+
+ \param[in] other the other package
+ \return number of differences found, or -1 if the packages can't be compared
+ */
+int Package::diff(Package &other) {
+  if (part_.size() != other.part_.size()) {
+    std::cout << "WARNING: Number of parts in package differ!" << std::endl;
+    return -1;
+  }
+  int n_diff = 0;
+  for (size_t i=0; i<part_.size(); ++i) {
+    int n = part_[i]->diff(*other.part_[i]);
+    if (n < 0)
+      return -1;
+    n_diff += n;
+  }
+  return n_diff;
+}
+
 /**
  Compare this package byte-by-byte to another package file.
  \param[in] other_package_file file path and name of the contender
  \return 0 if file content creates the same binary representation
  */
 int Package::compareFile(const std::string &other_package_file) {
-  std::vector<uint8_t> new_pkg;
-  std::ifstream new_file { other_package_file, std::ios::binary };
-  if (new_file) {
-    new_pkg.assign(std::istreambuf_iterator<char>{new_file}, {});
-    if (new_pkg == *pkg_bytes_) {
-      //      std::cout << "compareBinaries: Packages are identical." << std::endl;
-      //      std::cout << "OK." << std::endl;
-    } else {
-      int i, n = std::min((int)new_pkg.size(), (int)pkg_bytes_->size());
-      for (i=0; i<n; ++i) {
-        if (new_pkg[i] != pkg_bytes_->at(i)) break;
-      }
-      std::cout << "ERROR: compareFile: Packages differ starting at 0x"
-      << std::setw(8) << std::setfill('0') << std::hex << i << std::dec
-      << " = " << i << "!" << std::endl;
-    }
-    std::cout << std::endl;
-    return 0;
+  PackageBytes new_pkg;
+  if (new_pkg.map(other_package_file) == 0) {
+    size_t first, last;
+    if (!findDifference(pkg_bytes_->span(), new_pkg.span(), first, last))
+      return 0;
+    std::cout << "ERROR: compareFile: Packages differ from 0x"
+    << std::setw(8) << std::setfill('0') << std::hex << first << " to 0x"
+    << std::setw(8) << std::setfill('0') << last << std::dec
+    << " = " << first << " to " << last << "!" << std::endl;
+    return -1;
   }
   std::cout << "compareFile: Unable to read new file \"" << other_package_file << "\"." << std::endl;
   return -1;
 }
 
+/**
+ Write the Package as a binary package file.
+
+ This is the same as writing an assembler file and running it through the
+ GNU assembler and objcopy, but needs no external tools. Data in the
+ original file beyond the size given in the header is appended unchanged.
+
+ \param[in] package_file_name file path and name
+ \return 0 if successful
+ */
+int Package::writeBinary(const std::string &package_file_name)
+{
+  ByteWriter w;
+  w.reserve(pkg_bytes_->size());
+  if (writeBinary(w) < 0) {
+    std::cout << "ERROR: writeBinary: Unable to create binary data for \"" << package_file_name << "\"." << std::endl;
+    return -1;
+  }
+  if (size_ < pkg_bytes_->size())
+    w.put_data(pkg_bytes_->span().subspan(size_));
+
+  std::ofstream pkg_file { package_file_name, std::ios::binary };
+  if (pkg_file.fail()) {
+    std::cout << "writeBinary: Unable to write package file \"" << package_file_name << "\"." << std::endl;
+    return -1;
+  }
+  pkg_file.write(reinterpret_cast<const char*>(w.data().data()), (std::streamsize)w.data().size());
+  if (pkg_file.fail()) {
+    std::cout << "writeBinary: Error writing package file \"" << package_file_name << "\"." << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ Rebuild the package in memory and compare it to the original file.
+ \return 0 if the rebuilt package is identical to the original
+ */
+int Package::verifyBinary()
+{
+  ByteWriter w;
+  w.reserve(pkg_bytes_->size());
+  if (writeBinary(w) < 0)
+    return -1;
+  if (size_ < pkg_bytes_->size())
+    w.put_data(pkg_bytes_->span().subspan(size_));
+  size_t i, last;
+  if (!findDifference(w.data(), pkg_bytes_->span(), i, last))
+    return 0;
+  std::cout << "ERROR: verifyBinary: Packages differ starting at 0x"
+  << std::setw(8) << std::setfill('0') << std::hex << i << std::dec
+  << " = " << i << "!" << std::endl;
+  return -1;
+}
+
 /**
  Compare this package to the the contents of another package file.
+
+ Most packages that are compared are identical, so the raw bytes are
+ compared first. Only if they differ, the other package is indexed, and the
+ parts and objects in the range of bytes that differ are decoded and
+ compared one by one.
+
  \param[in] other_package_file file path and name of the contender
  \return 0 if file content creates the same binary representation
  */
 int Package::compareContents(const std::string &other_package_file) {
   Package other;
-  if (other.load(other_package_file)==-1) {
-    std::cout << "ERROR: compareContents: Can'r read package \"" << other_package_file << "\"." << std::endl;
+  other.file_name_ = other_package_file;
+  other.pkg_bytes_ = std::make_shared<PackageBytes>();
+  if (other.pkg_bytes_->map(other_package_file) != 0) {
+    std::cout << "ERROR: compareContents: Can't read package \"" << other_package_file << "\"." << std::endl;
     return -1;
   }
-  return compare(other);
+  size_t first, last;
+  if (!findDifference(pkg_bytes_->span(), other.pkg_bytes_->span(), first, last))
+    return 0;
+  if (other.load(kLoadMapped | kLoadLazy | kLoadIndexOnly, nullptr) == -1) {
+    std::cout << "ERROR: compareContents: Can't read package \"" << other_package_file << "\"." << std::endl;
+    return -1;
+  }
+  return compare(other, (uint32_t)first, (uint32_t)std::min(last, (size_t)UINT32_MAX));
 }
 
 /**
  Convert this package into a Newton OS object tree.
+
+ All objects of the tree are created in a Heap that is owned by the Package.
+ The tree is released in one go when the Package is destroyed or when
+ toNOS() is called again.
+
+ If an object store is given, the contents of the parts are created in the
+ store instead and live as long as the store.
+
+ \param[in] store share objects with other packages through this store
  \return the object tree or an error code as an integer
  */
-nos::Ref Package::toNOS() {
+nos::Ref Package::toNOS(ObjectStore *store) {
+  nos_heap_ = std::make_shared<nos::Heap>((pkg_bytes_ && !store) ? pkg_bytes_->size() * 2 : 0);
+  nos::HeapScope heap_scope(*nos_heap_);
   nos::Ref pkg = nos::AllocateFrame();
   nos::SetFrameSlot(pkg, nos::Sym("signature"), nos::MakeString(signature_));
   nos::SetFrameSlot(pkg, nos::Sym("type"), nos::MakeString(type_));
@@ -434,7 +904,7 @@ nos::Ref Package::toNOS() {
 //nos::SetFrameSlot(pkg, nos::Sym("info"), nos::MakeString(std::string(info_)));
   nos::Ref parts = nos::AllocateArray(0);
   for (auto &part: part_) {
-    nos::AddArraySlot(parts, part->toNOS());
+    nos::AddArraySlot(parts, part->toNOS(store));
   }
   nos::SetFrameSlot(pkg, nos::Sym("parts"), parts);
   return pkg;
@@ -24,15 +24,57 @@
 #include <fstream>
 #include <ios>
 #include <cstdlib>
+#include <cstdint>
 
 #include "relocation_data.h"
 
 #include "nos/ref.h"
 
+class AsmWriter;
+class ThreadPool;
+
+namespace nos {
+class Heap;
+}
+
 namespace pkg {
 
+/// Map the package file into memory instead of reading it into a buffer.
+constexpr uint32_t kLoadMapped = 0x00000001;
+/// Read the header and directory only, load part data when first accessed.
+constexpr uint32_t kLoadLazy = 0x00000002;
+/// Index the objects in NOS parts, decode each object when first accessed.
+constexpr uint32_t kLoadIndexOnly = 0x00000004;
+
 class PartEntry;
+class ObjectStore;
 class PackageBytes;
+class ByteWriter;
+
+/**
+ Directory information of one part, as returned by Package::scanHeader().
+ */
+struct PartSummary {
+  std::string type_ { };
+  uint32_t flags_ {0};
+  uint32_t size_ {0};
+};
+
+/**
+ Header and directory information of a package, as returned by
+ Package::scanHeader().
+ */
+struct PackageSummary {
+  std::string signature_ { };
+  std::string type_ { };
+  uint32_t flags_ {0};
+  uint32_t version_ {0};
+  std::string copyright_ { };
+  std::string name_ { };
+  uint32_t size_ {0};
+  uint32_t date_ {0};
+  std::vector<PartSummary> part_ { };
+};
 
 class Package {
   std::string signature_ { };
@@ -52,18 +94,22 @@ class Package {
   uint32_t vdata_start_ {0};
 //  uint32_t info_start_ {0};
   uint32_t info_length_ {0};
+  uint32_t part_data_start_ {0};
   std::vector<std::shared_ptr<PartEntry>> part_ { };
   std::string copyright_ { };
   std::string name_ { };
-  std::vector<uint8_t> info_ { };
+  std::span<const uint8_t> info_ { };
   RelocationData relocation_data_;
 
   std::string file_name_ { };
   std::shared_ptr<PackageBytes> pkg_bytes_ { nullptr };
+  std::shared_ptr<nos::Heap> nos_heap_ { nullptr };
 
-  int load();
-  int writeAsm(std::ofstream &f);
-  int compare(Package &other);
+  int load(uint32_t load_flags, ThreadPool *pool);
+  int writeAsm(AsmWriter &f, ThreadPool *pool);
+  int writeAsmParts(AsmWriter &f, ThreadPool *pool);
+  int writeBinary(ByteWriter &w);
+  int compare(Package &other, uint32_t first = 0, uint32_t last = UINT32_MAX);
 
 public:
   Package() = default;
@@ -73,11 +119,26 @@ public:
   Package& operator=(Package const& rhs) = delete;
   Package& operator=(Package const&& rhs) = delete;
 
-  int load(const std::string &package_file_name);
-  int writeAsm(const std::string &assembler_file_name);
+  static int scanHeader(const std::string &package_file_name, PackageSummary &summary);
+  int load(const std::string &package_file_name, uint32_t load_flags = kLoadMapped,
+           ThreadPool *pool = nullptr);
+  int writeAsm(const std::string &assembler_file_name, ThreadPool *pool = nullptr);
+  int writeBinary(const std::string &package_file_name);
+  int verifyBinary();
   int compareFile(const std::string &other_package_file);
   int compareContents(const std::string &other_package_file);
-  nos::Ref toNOS();
+  int diff(Package &other);
+  nos::Ref toNOS(ObjectStore *store = nullptr);
+
+  const std::string &signature() const { return signature_; }
+  const std::string &type() const { return type_; }
+  uint32_t flags() const { return flags_; }
+  uint32_t version() const { return version_; }
+  const std::string &copyright() const { return copyright_; }
+  const std::string &name() const { return name_; }
+  uint32_t date() const { return date_; }
+  int numParts() const { return (int)part_.size(); }
+  PartEntry &part(int ix) { return *part_[ix]; }
 };
 
 
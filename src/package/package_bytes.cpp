@@ -24,18 +24,131 @@
 #include <iostream>
 #include <fstream>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 using namespace pkg;
 
 /** \class pkg::PackageBytes
  Streaming access to the 32bit MSB data in a NewtonScript Package.
+
+ The bytes are either mapped read-only from the package file, or read into
+ an internal buffer. Strings and data blocks returned by the readers point
+ directly into that memory, so the PackageBytes must outlive anything that
+ was loaded from it.
+ */
+
+/**
+ Unmap or free the package data.
+ */
+PackageBytes::~PackageBytes()
+{
+  release();
+}
+
+/**
+ Map a package file into memory without copying it.
+ If the file can't be mapped (empty file, no mmap support on this platform,
+ or the file system refuses), fall back to reading the file into a buffer.
+ \param[in] file_name path and name of the package file
+ \return 0 if successful
+ */
+int PackageBytes::map(const std::string &file_name)
+{
+#ifdef _WIN32
+  return read(file_name);
+#else
+  release();
+  int fd = ::open(file_name.c_str(), O_RDONLY);
+  if (fd == -1)
+    return -1;
+  struct stat st;
+  if ((::fstat(fd, &st) == -1) || (st.st_size == 0)) {
+    ::close(fd);
+    return read(file_name);
+  }
+  void *m = ::mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (m == MAP_FAILED)
+    return read(file_name);
+  map_ = m;
+  map_size_ = (size_t)st.st_size;
+  data_ = static_cast<const uint8_t*>(map_);
+  size_ = map_size_;
+  rewind();
+  return 0;
+#endif
+}
+
+/**
+ Read an entire package file into memory with a single read call.
+ \param[in] file_name path and name of the package file
+ \return 0 if successful
+ */
+int PackageBytes::read(const std::string &file_name)
+{
+  release();
+  std::ifstream source_file { file_name, std::ios::binary | std::ios::ate };
+  if (!source_file)
+    return -1;
+  std::streamsize n = source_file.tellg();
+  if (n < 0)
+    return -1;
+  buffer_.resize((size_t)n);
+  source_file.seekg(0);
+  if (n > 0 && !source_file.read(reinterpret_cast<char*>(buffer_.data()), n)) {
+    buffer_.clear();
+    return -1;
+  }
+  data_ = buffer_.data();
+  size_ = buffer_.size();
+  rewind();
+  return 0;
+}
+
+/**
+ Unmap the file or free the buffer.
+ All data returned by the readers becomes invalid.
+ */
+void PackageBytes::release()
+{
+#ifndef _WIN32
+  if (map_)
+    ::munmap(map_, map_size_);
+#endif
+  map_ = nullptr;
+  map_size_ = 0;
+  buffer_.clear();
+  buffer_.shrink_to_fit();
+  data_ = nullptr;
+  size_ = 0;
+  cursor_ = ByteCursor();
+}
+
+/**
+ Access the data of another PackageBytes with an independent read position.
+ The data is not copied, so the source must outlive this object. This allows
+ multiple threads to read from the same package at the same time.
+ \param[in] source the package data
  */
+void PackageBytes::view(const PackageBytes &source)
+{
+  release();
+  data_ = source.data_;
+  size_ = source.size_;
+  rewind();
+}
 
 /**
  Set the iterator back to the first byte.
  */
 void PackageBytes::rewind()
 {
-  it_ = begin();
+  cursor_ = ByteCursor(span());
 }
 
 /**
@@ -44,7 +157,7 @@ void PackageBytes::rewind()
  */
 void PackageBytes::seek_set(int ix)
 {
-  it_ = begin() + ix;
+  cursor_.seek_set((size_t)ix);
 }
 
 /**
@@ -53,7 +166,7 @@ void PackageBytes::seek_set(int ix)
  */
 int PackageBytes::tell()
 {
-  return (int)(it_ - begin());
+  return (int)cursor_.tell();
 }
 
 /**
@@ -62,46 +175,56 @@ int PackageBytes::tell()
  */
 bool PackageBytes::eof()
 {
-  return it_ == end();
+  return cursor_.eof();
 }
 
 /**
- Get one byte and advance the iterator.
- \return the current byte
+ Get a 32 bit NS Ref and advance the iterator.
+ This outputs an error if the value is not a valid Ref.
+ \return a integer in the native byte order.
  */
-uint8_t PackageBytes::get_ubyte() {
-  return *it_++;
+uint32_t PackageBytes::get_ref() {
+  uint32_t v = get_uint();
+  check_ref(v, tell());
+  return v;
 }
 
 /**
- Get one 16 bit word in MSB format and advance the iterator.
- \return a short integer in the native byte order.
+ Read a block of 32 bit MSB words in one go.
+ \param[out] dst room for at least n words
+ \param[in] n number of words
+ \return kReadOK, or kReadOverrun if the data ends early
  */
-uint16_t PackageBytes::get_ushort()
-{
-  uint16_t v;
-  v = ((*it_++)<<8)|(*it_++);
-  return v;
+int PackageBytes::get_uints(uint32_t *dst, int n) {
+  if (n <= 0) return kReadOK;
+  return cursor_.get_uints(dst, (size_t)n);
 }
 
 /**
- Get one 32 bit word in MSB format and advance the iterator.
- \return a integer in the native byte order.
+ Read a block of NS Refs in one go and check them like get_ref() does.
+ \param[out] dst room for at least n Refs
+ \param[in] n number of Refs
+ \return kReadOK, or kReadOverrun if the data ends early
  */
-uint32_t PackageBytes::get_uint() {
-  uint32_t v;
-  v = ((*it_++)<<24)|((*it_++)<<16)|((*it_++)<<8)|(*it_++);
-  return v;
+int PackageBytes::get_refs(uint32_t *dst, int n) {
+  if (n <= 0) return kReadOK;
+  int start = tell();
+  int err = cursor_.get_uints(dst, (size_t)n);
+  if (err != kReadOK) return err;
+  for (int i=0; i<n; ++i) {
+    // Integers and pointers are always valid, only look closer at immediates
+    if ((dst[i] & 3) == 2)
+      check_ref(dst[i], start + (i+1)*4);
+  }
+  return kReadOK;
 }
 
 /**
- Get a 32 bit NS Ref and advance the iterator.
- This outputs an error if the value is not a valid Ref.
- \return a integer in the native byte order.
+ Output a warning if a Ref does not have a known value.
+ \param[in] v the Ref as found in the package
+ \param[in] pos file position after the Ref, used in the warning
  */
-uint32_t PackageBytes::get_ref() {
-  uint32_t v;
-  v = get_uint();
+void PackageBytes::check_ref(uint32_t v, int pos) {
   if ((v & 0x0000000f) == 0x00000002) { // 00.10 special
     if (   (v != 0x00000002) // NIL
 //      && (v != 0x00000012) // kWeakArrayClass, used for caching Soup data
@@ -115,27 +238,26 @@ uint32_t PackageBytes::get_ref() {
 //      && (v != 0x0000FFF2) // kNewtRefUnbind, (newt/0) Ref is not initialized or bound to anything
         ) {
       std::cout << "WARNING: 0x"
-      << std::setw(8) << std::setfill('0') << std::hex << tell() << std::dec
+      << std::setw(8) << std::setfill('0') << std::hex << pos << std::dec
       << ": get_ref: unknown special ref: " << std::hex << v << std::dec << std::endl;
     }
   } else if ((v & 0x0000000f) == 0x00000006) { // b01`10 16 bit char
     if ((v & 0xfff00000)!=0) {
       std::cout << "WARNING: 0x"
-      << std::setw(8) << std::setfill('0') << std::hex << tell() << std::dec
+      << std::setw(8) << std::setfill('0') << std::hex << pos << std::dec
       << ": get_ref: invalid char: " << std::hex << v << std::dec << std::endl;
     }
   } else if ((v & 0x0000000f) == 0x0000000a) { // b10`10 boolean
     if (v != 0x0000001a) { // TRUE
       std::cout << "WARNING: 0x"
-      << std::setw(8) << std::setfill('0') << std::hex << tell() << std::dec
+      << std::setw(8) << std::setfill('0') << std::hex << pos << std::dec
       << ": get_ref: unknown boolean: " << std::hex << v << std::dec << std::endl;
     }
   } else if ((v & 0x0000000f) == 0x0000000e) { // b11`10 reserved
     std::cout << "WARNING: 0x"
-    << std::setw(8) << std::setfill('0') << std::hex << tell() << std::dec
+    << std::setw(8) << std::setfill('0') << std::hex << pos << std::dec
     << ": get_ref: reserved ref: " << std::hex << v << std::dec << std::endl;
   }
-  return v;
 }
 
 /**
@@ -145,17 +267,10 @@ uint32_t PackageBytes::get_ref() {
  character is actually NUL.
  \param[in] n number of bytes in string, not counting the trailing NUL
  \param[in] trailing_nul if set (default), skip over the trailing NUL
- \return a std::string with the text, no further conversion is done.
- */
-std::string PackageBytes::get_cstring(int n, bool trailing_nul) {
-  PackageBytes::iterator it_start = it_;
-  if (trailing_nul) {
-    it_ += n+1;
-    return std::string(it_start, it_-1);
-  } else {
-    it_ += n;
-    return std::string(it_start, it_);
-  }
+ \return a view into the package data, no further conversion is done.
+ */
+std::string_view PackageBytes::get_cstring(int n, bool trailing_nul) {
+  return cursor_.get_cstring((size_t)n, trailing_nul);
 }
 
 /**
@@ -166,21 +281,21 @@ std::string PackageBytes::get_cstring(int n, bool trailing_nul) {
  \return a std::string in UTF-8 format
  */
 std::string PackageBytes::get_ustring(int n, bool trailing_nul) {
-  std::u16string s;
-  for (int i=0; i<n; i++) s += get_ushort();
-  if (trailing_nul) get_ushort();
+  if (n < 0) return std::string();
+  auto src = cursor_.get_data((size_t)(trailing_nul ? n+1 : n) * 2);
+  if (src.empty()) return std::string();
+  std::u16string s((size_t)n, u'\0');
+  for (int i=0; i<n; i++) s[i] = (char16_t)load_be16(&src[i*2]);
   return utf16_to_utf8(s);
 }
 
 /**
  Read a block of raw data and advance the iterator.
  \param[in] n number of bytes to read
- \return a vector with the unmodified bytes
+ \return a view of the unmodified bytes in the package data
  */
-std::vector<uint8_t> PackageBytes::get_data(int n) {
-  auto it_start = it_;
-  it_ += n;
-  return std::vector<uint8_t>(it_start, it_);
+std::span<const uint8_t> PackageBytes::get_data(int n) {
+  return cursor_.get_data((size_t)n);
 }
 
 /**
@@ -23,32 +23,62 @@
 #include <ios>
 #include <cstdlib>
 #include <vector>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "byte_cursor.h"
 
 namespace pkg {
 
-class PackageBytes : public std::vector<uint8_t>
+class PackageBytes
 {
-  PackageBytes::iterator it_;
+  std::vector<uint8_t> buffer_;
+  void *map_ { nullptr };
+  size_t map_size_ { 0 };
+  const uint8_t *data_ { nullptr };
+  size_t size_ { 0 };
+  ByteCursor cursor_ { };
+
+  void check_ref(uint32_t v, int pos);
 
 public:
   PackageBytes() = default;
-  ~PackageBytes() = default;
+  ~PackageBytes();
   PackageBytes(PackageBytes const& rhs) = delete;
   PackageBytes(PackageBytes const&& rhs) = delete;
   PackageBytes& operator=(PackageBytes const& rhs) = delete;
   PackageBytes& operator=(PackageBytes const&& rhs) = delete;
 
+  int map(const std::string &file_name);
+  int read(const std::string &file_name);
+  void view(const PackageBytes &source);
+  void release();
+  bool mapped() const { return map_ != nullptr; }
+
+  size_t size() const { return size_; }
+  const uint8_t *data() const { return data_; }
+  const uint8_t *begin() const { return data_; }
+  const uint8_t *end() const { return data_ + size_; }
+  uint8_t operator[](size_t ix) const { return data_[ix]; }
+  std::span<const uint8_t> span() const { return { data_, size_ }; }
+
+  int error() const { return cursor_.error(); }
+  void clear_error() { cursor_.clear_error(); }
+
   void rewind();
   void seek_set(int ix);
   int tell();
   bool eof();
-  uint8_t get_ubyte();
-  uint16_t get_ushort();
-  uint32_t get_uint();
+  uint8_t get_ubyte() { return cursor_.get_ubyte(); }
+  uint16_t get_ushort() { return cursor_.get_ushort(); }
+  uint32_t get_uint() { return cursor_.get_uint(); }
   uint32_t get_ref();
-  std::string get_cstring(int n, bool trailing_nul=true);
+  int get_uints(uint32_t *dst, int n);
+  int get_refs(uint32_t *dst, int n);
+  std::string_view get_cstring(int n, bool trailing_nul=true);
   std::string get_ustring(int n, bool trailing_nul=true);
-  std::vector<uint8_t> get_data(int n);
+  std::span<const uint8_t> get_data(int n);
   void align(int n);
 };
 
@@ -20,15 +20,27 @@
 #include "part_data.h"
 
 #include "package_bytes.h"
+#include "byte_writer.h"
 #include "part_entry.h"
+#include "object_store.h"
+#include "package.h"
 #include "tools/tools.h"
+#include "tools/asm_writer.h"
+#include "tools/thread_pool.h"
 
 #include "nos/objects.h"
+#include "nos/heap.h"
 
 #include <iostream>
 #include <fstream>
 #include <ios>
-#include <cassert>
+#include <cctype>
+#include <algorithm>
+#include <atomic>
+#include <latch>
+#include <charconv>
+#include <cstring>
+#include <unordered_set>
 
 using namespace pkg;
 
@@ -49,15 +61,28 @@ int PartData::index() {
 /**
  Compare this part with the other part.
  \param[in] other the other part
+ \param[in] first, last range of package offsets that may differ
  \return 0 if they are the same.
  */
-int PartData::compare(PartData &other)
+int PartData::compare(PartData &other, uint32_t first, uint32_t last)
 {
   std::cout << "WARNING: Part type not supported;" << std::endl;
   (void)other;
+  (void)first;
+  (void)last;
   return -1;
 }
 
+/**
+ List the differences between this part and the other part.
+ \param[in] other the other part
+ \return number of differences found
+ */
+int PartData::diff(PartData &other)
+{
+  return (compare(other, 0, UINT32_MAX) == 0) ? 0 : 1;
+}
+
 
 /** \class pkg::PartDataGeneric
  Holds the uninterpreted data of a Part with raw data or unknown type.
@@ -66,11 +91,13 @@ int PartData::compare(PartData &other)
 /**
  Read the Part of the Package as raw data.
  \param[in] p package data stream
+ \param[in] load_flags unused
+ \param[in] pool unused
  \return 0 if succeeded
  */
-int PartDataGeneric::load(PackageBytes &p) {
+int PartDataGeneric::load(PackageBytes &p, uint32_t, ThreadPool *) {
   data_ = p.get_data(part_entry_.size());
-  return 0;
+  return p.error();
 }
 
 /**
@@ -78,16 +105,28 @@ int PartDataGeneric::load(PackageBytes &p) {
  \param[in] f output stream
  \return number of bytes written
  */
-int PartDataGeneric::writeAsm(std::ofstream &f) {
-  f << "@ ===== Part " << part_entry_.index() << " Data Generic" << std::endl;
-  f << "part_" << part_entry_.index() << ":" << std::endl;
+int PartDataGeneric::writeAsm(AsmWriter &f) {
+  f << "@ ===== Part " << part_entry_.index() << " Data Generic\n";
+  f << "part_" << part_entry_.index() << ":\n";
   write_data(f, data_);
-  f << "\t.balign\t4" << std::endl << std::endl;
-  f << "part_" << part_entry_.index() << "_end:" << std::endl;
-  f << "@ ===== Part " << part_entry_.index() << " End" << std::endl << std::endl;
+  f << "\t.balign\t4\n\n";
+  f << "part_" << part_entry_.index() << "_end:\n";
+  f << "@ ===== Part " << part_entry_.index() << " End\n\n";
   return part_entry_.size();
 }
 
+/**
+ Write raw Package Part data in binary package format.
+ \param[in] w append the data here
+ \return number of bytes written
+ */
+int PartDataGeneric::writeBinary(ByteWriter &w) {
+  size_t start = w.tell();
+  w.put_data(data_);
+  w.align(4, 0);
+  return (int)(w.tell() - start);
+}
+
 // MARK: -
 
 /** \class pkg::Object
@@ -95,52 +134,73 @@ int PartDataGeneric::writeAsm(std::ofstream &f) {
  */
 
 /**
- Create a new Object by peeking at the next three words in the package data.
- \param[in] p package data stream
- \return a new instantiation of a class derived from Object
+ Allocate an Object of type T in the arena.
  */
-std::shared_ptr<Object> Object::peek(PackageBytes &p, uint32_t offset)
+template<class T>
+static Object *create_object(uint32_t offset, ObjectArena &arena)
 {
-  int pos = p.tell();
-  uint32_t header_ = p.get_uint();
-  p.get_uint();
-  uint32_t class_ = p.get_uint();
-  p.seek_set(pos);
-  switch (header_ & 0x00000003) {
-    case 0:
-      // TODO: use the symbol to get information and find Reals and ByteCode
-      // There are also machine code block, bitmaps, sounds etc. .
-      if (class_ == 0x00055552)
-        return std::make_shared<ObjectSymbol>(offset); // Symbol
-      else
-        return std::make_shared<ObjectBinary>(offset); // Binary
-    case 1:
-      // If the class is an integer, the array is used to store a map
-      // for a Frame. Check what flags are set (sorted(1), _proto(4)),
-      // and if any map has a supermap.
-      if ((class_ & 0x00000003) == 0)
-        return std::make_shared<ObjectMap>(offset); // Map
-      else
-        return std::make_shared<ObjectSlotted>(offset); // Array
-      // TODO: what other special class values are there?
-    default:
-    case 2: return std::make_shared<ObjectBinary>(offset); // Unknown
-    case 3: return std::make_shared<ObjectSlotted>(offset); // Frame
-  }
+  return arena.create<T>(offset);
 }
 
 /**
- Load the head of an Object; derived class must load the remaining data.
- \parm[in] p reference to the biary data
- \return 0 if successful
+ Object classes by type in the header (Binary, Array, unknown, Frame) and by
+ a tag derived from the class Ref, see Object::decode().
+ */
+static Object *(* const kObjectFactory[4][2])(uint32_t, ObjectArena&) = {
+  { create_object<ObjectBinary>,  create_object<ObjectSymbol> },  // class is 'symbol
+  { create_object<ObjectSlotted>, create_object<ObjectMap> },     // class is an integer
+  { create_object<ObjectBinary>,  create_object<ObjectBinary> },  // unknown
+  { create_object<ObjectSlotted>, create_object<ObjectSlotted> }, // Frame
+};
+
+/**
+ Read the header of the next Object and create an Object of the matching class.
+
+ The header, ref count, and class are read only once and stored in the new
+ Object. The derived class then loads the remaining data in load().
+
+ \param[in] p package data stream
+ \param[in] offset position of the object in the package
+ \param[in] arena the object is allocated in this arena
+ \return a new instantiation of a class derived from Object, or nullptr if
+      the header reaches beyond the end of the package
  */
-int Object::load(PackageBytes &p)
+Object *Object::decode(PackageBytes &p, uint32_t offset, ObjectArena &arena)
 {
   uint32_t header = p.get_uint();
+  uint32_t ref_cnt = p.get_uint();
+  uint32_t klass = p.get_ref();
+  if (p.error())
+    return nullptr;
+  uint32_t type = header & 0x00000003;
+  // TODO: use the symbol to get information and find Reals and ByteCode
+  // There are also machine code block, bitmaps, sounds etc. .
+  // If the class of an Array is an integer, the array is used to store a map
+  // for a Frame. Check what flags are set (sorted(1), _proto(4)),
+  // and if any map has a supermap.
+  // TODO: what other special class values are there?
+  int tag = 0;
+  if (type == 0)
+    tag = (klass == 0x00055552);
+  else if (type == 1)
+    tag = ((klass & 0x00000003) == 0);
+  Object *o = kObjectFactory[type][tag](offset, arena);
+  o->setHeader(header, ref_cnt, klass);
+  return o;
+}
+
+/**
+ Set the fields that are common to all Objects.
+ \param[in] header the first word of the object with size, flags, and type
+ \param[in] ref_cnt the reference count
+ \param[in] klass the class Ref
+ */
+void Object::setHeader(uint32_t header, uint32_t ref_cnt, uint32_t klass)
+{
   type_ = (header & 0x00000003);
   if (type_ == 2) {
     std::cout << "ERROR: 0x"
-      << std::setw(8) << std::setfill('0') << std::hex << p.tell() << std::dec
+      << std::setw(8) << std::setfill('0') << std::hex << offset_+4 << std::dec
       << ": NS Object type unknown." << std::endl;
     size_ = 0;
   }
@@ -155,14 +215,15 @@ int Object::load(PackageBytes &p)
     std::cout << "WARNING: NS Object flags should be 0x40, but it's 0x"
     << std::setw(2) << std::setfill('0') << std::hex << (header & 0x000000fc) << std::dec
     << "." << std::endl;
-  size_  = ((header >> 8) - 8);
-  if (size_ < 0) {
+  uint32_t total_size = (header >> 8);
+  if (total_size < 8) {
     std::cout << "ERROR: NS Object size <0 found." << std::endl;
     size_ = 0;
+  } else {
+    size_ = total_size - 8;
   }
-  ref_cnt_ = p.get_uint();
-  class_ = p.get_ref();
-  return 0;
+  ref_cnt_ = ref_cnt;
+  class_ = klass;
 }
 
 /**
@@ -186,27 +247,40 @@ void Object::loadPadding(PackageBytes &p, uint32_t start, uint32_t align) {
  \param[in] p back reference to part data
  \return number of bytes written
  */
-int Object::writeAsm(std::ofstream &f, PartDataNOS &p)
+int Object::writeAsm(AsmWriter &f, PartDataNOS &p)
 {
   (void)p;
-  f << label() << ":" << std::endl;
+  f << label() << ":\n";
 #if 0
   f << "\t.int\t(" << size_ << "+8)<<8 | " << flags_ << " | " << type_;
 #else
   f << "\t.int\t(1f-.)<<8 | " << flags_ << " | " << type_;
 #endif
-  f << ", " << ref_cnt_ << std::endl;
+  f << ", " << ref_cnt_ << '\n';
   return 8;
 }
 
+/**
+ Write the common header data of an NOS object in binary package format.
+ The size is calculated from the data that the derived class will write.
+ \param[in] w append the data here
+ \param[in] p back reference to part data
+ */
+void Object::writeBinary(ByteWriter &w, PartDataNOS &p)
+{
+  (void)p;
+  w.put_uint((binarySize() << 8) | flags_ | type_);
+  w.put_uint(ref_cnt_);
+}
+
 /**
  Generate a simple assembler label using the part index and the offset in the package file.
  \param[in] p Part data reference.
  */
 void Object::makeAsmLabel(PartDataNOS &p) {
   char buf[32];
-  ::snprintf(buf, 31, "obj_%d_%d", p.index(), offset_);
-  label_ = buf;
+  int n = ::snprintf(buf, 31, "obj_%d_%d", p.index(), offset_);
+  label_ = p.arena().copyString({ buf, (size_t)std::min(n, 30) });
 }
 
 int Object::compareBase(Object &other)
@@ -231,6 +305,24 @@ int Object::compareBase(Object &other)
   return ret;
 }
 
+/**
+ Add the content of this object to a hash.
+
+ Refs to other objects don't add their offset, which changes whenever an
+ object is inserted before them, but the hash of the object they point to.
+ A shallow hash adds the same marker for every pointer instead.
+
+ \param[in] h add to this hash
+ \param[in] p back reference to part data
+ \param[in] deep add the hashes of objects that Refs point to
+ */
+void Object::hash(ContentHasher &h, PartDataNOS &p, bool deep)
+{
+  h.add(type_);
+  h.add(flags_);
+  p.hashRef(h, class_, deep);
+}
+
 // MARK: -
 
 /** \class pkg::Object
@@ -238,15 +330,39 @@ int Object::compareBase(Object &other)
  */
 
 /**
- Read a binary object form the Package stream.
+ Read the data of a binary object form the Package stream.
+ The object header was already read by Object::decode().
  \param[in] p package data stream
  \return 0 if succeeded
  */
-int ObjectBinary::load(PackageBytes &p)
+int ObjectBinary::load(PackageBytes &p, ObjectArena &)
 {
-  Object::load(p);
   data_ = p.get_data(size_-4);
-  return 0;
+  return p.error();
+}
+
+/**
+ Find out if the class of this binary is a well known symbol.
+ This is done once after loading, so that writing the object only compares
+ integers.
+ \param[in] p back reference to part data
+ */
+void ObjectBinary::resolve(PartDataNOS &p)
+{
+  class_id_ = p.symbolID(class_);
+}
+
+/**
+ Check that no byte code command reaches past the end of the data.
+ \param[in] data NewtonScript byte code
+ \return true if the last command is complete
+ */
+static bool instructions_complete(std::span<const uint8_t> data)
+{
+  size_t n = data.size(), i = 0;
+  while (i < n)
+    i += ((data[i] & 0x07) == 7) ? 3 : 1;
+  return (i == n);
 }
 
 /**
@@ -259,14 +375,19 @@ int ObjectBinary::load(PackageBytes &p)
  \param[in] p back reference to part data
  \return number of bytes written
  */
-int ObjectBinary::writeAsm(std::ofstream &f, PartDataNOS &p)
+int ObjectBinary::writeAsm(AsmWriter &f, PartDataNOS &p)
 {
-  f << "@ ----- " << offset_ << " Binary Object (" << size_-4 << " bytes)" << std::endl;
-  std::string klass = p.getSymbol(class_);
+  f << "@ ----- " << offset_ << " Binary Object (" << size_-4 << " bytes)\n";
   Object::writeAsm(f, p);
-  f << "\t" << p.asmRef(class_) << "\t@ class" << std::endl;
-  if (nos::symcmp(klass.c_str(), "instructions")==0) {
-    f << std::setfill(' ');
+  f << "\t" << p.asmRef(class_) << "\t@ class\n";
+  // Damaged objects are written as plain data, which rebuilds them as they were
+  if ((class_id_ == SymbolID::instructions) && !instructions_complete(data_)) {
+    std::cout << "WARNING: Object at " << offset_ << ", last instruction is cut off." << std::endl;
+    write_data(f, data_);
+  } else if ((class_id_ == SymbolID::real) && (data_.size() < 8)) {
+    std::cout << "WARNING: Object at " << offset_ << ", real number is too short." << std::endl;
+    write_data(f, data_);
+  } else if (class_id_ == SymbolID::instructions) {
     int n = (int)data_.size();
     for (int i=0; i<n; ) {
       uint8_t cmd = data_[i++];
@@ -274,9 +395,9 @@ int ObjectBinary::writeAsm(std::ofstream &f, PartDataNOS &p)
       uint16_t b = (cmd & 0x07);
       if (b==7) {
         b = data_[i]<<8 | data_[i+1]; i += 2;
-        f << "\tnscmd3\t" << std::setw(2) << (int)a << ", " << std::setw(5) << (int)b << "\t@ ";
+        f << "\tnscmd3\t" << AsmDec(a, 2) << ", " << AsmDec(b, 5) << "\t@ ";
       } else {
-        f << "\tnscmd1\t" << std::setw(2) << (int)a << ", " << std::setw(5) << (int)b << "\t@ ";
+        f << "\tnscmd1\t" << AsmDec(a, 2) << ", " << AsmDec(b, 5) << "\t@ ";
       }
       switch (a) {
         case 0:
@@ -343,14 +464,13 @@ int ObjectBinary::writeAsm(std::ofstream &f, PartDataNOS &p)
           break;
         case 25: f << "new_handlers " << b; break;
       }
-      f << std::endl;
+      f << '\n';
     }
-    f << std::setfill('0');
-  } else if (nos::symcmp(klass.c_str(), "real")==0) {
+  } else if (class_id_ == SymbolID::real) {
     union { uint64_t x; double d; } v;
     ::memcpy(&v.x, &data_[0], 8);
     v.x = htonll(v.x);
-    f << "\t@.double\t" << v.d << std::endl;
+    f << "\t@.double\t" << v.d << '\n';
     write_data(f, data_);
   } else {
     write_data(f, data_);
@@ -358,6 +478,18 @@ int ObjectBinary::writeAsm(std::ofstream &f, PartDataNOS &p)
   return size_;
 }
 
+/**
+ Write a binary object in binary package format.
+ \param[in] w append the data here
+ \param[in] p back reference to part data
+ */
+void ObjectBinary::writeBinary(ByteWriter &w, PartDataNOS &p)
+{
+  Object::writeBinary(w, p);
+  w.put_uint(p.binaryRef(class_));
+  w.put_data(data_);
+}
+
 /**
  Compare objects.
  \param[in] other_obj the other object
@@ -368,30 +500,38 @@ int ObjectBinary::compare(Object &other_obj)
   int ret = compareBase(other_obj);
   if (ret != 0) return ret;
   ObjectBinary &other = static_cast<ObjectBinary&>(other_obj);
-  if (data_ != other.data_) {
+  if (!std::ranges::equal(data_, other.data_)) {
     std::cout << "WARNING: Object at " << offset() << ", binary data differs!" << std::endl;
     ret = -1;
   }
   return ret;
 }
 
+/**
+ Add the class and the binary data to a hash.
+ \param[in] h add to this hash
+ \param[in] p back reference to part data
+ \param[in] deep add the hash of the class object
+ */
+void ObjectBinary::hash(ContentHasher &h, PartDataNOS &p, bool deep)
+{
+  Object::hash(h, p, deep);
+  h.add(data_);
+}
+
 nos::Ref ObjectBinary::toNOS(PartDataNOS &p) {
-  if (nos_object_)
-    return nos::Ref(nos_object_);
-  assert(!marked()); // discover recursion
-  mark(true);
   nos::Ref ret = nos::RefNIL;
   p.refToNOS(class_); // mark the object as used
-  std::string klass = p.getSymbol(class_);
-  if (nos::symcmp(klass.c_str(), "real")==0) {
+  // A real number that is too short is kept as a plain binary object
+  if ((class_id_ == SymbolID::real) && (data_.size() >= 8)) {
     union { uint64_t x; double d; } v;
     ::memcpy(&v.x, &data_[0], 8);
     v.x = htonll(v.x);
     ret = nos::MakeReal(v.d);
-  } else if (nos::symcmp(klass.c_str(), "string")==0) {
+  } else if (class_id_ == SymbolID::string) {
     std::u16string s;
     int n = (int)data_.size();
-    for (int i=0; i<n; i+=2) {
+    for (int i=0; i+1<n; i+=2) {
       uint16_t c = ((data_[i]<<8)|data_[i+1]);
       if (c==0) break;
       s += c;
@@ -405,7 +545,6 @@ nos::Ref ObjectBinary::toNOS(PartDataNOS &p) {
     ::memcpy(dst, data_.data(), data_size);
     ret = bin;
   }
-  nos_object_ = ret.GetObject();
   return ret;
 }
 
@@ -416,15 +555,48 @@ nos::Ref ObjectBinary::toNOS(PartDataNOS &p) {
  */
 
 /**
- Read a symbol form the Package stream.
+ Find the ID of a well known symbol.
+ Symbols are not case sensitive.
+ \param[in] symbol the symbol text
+ \return the ID, or SymbolID::other if this is not a well known symbol
+ */
+static SymbolID symbol_id(std::string_view symbol)
+{
+  static const struct { std::string_view text_; SymbolID id_; } kWellKnown[] = {
+    { "real", SymbolID::real },
+    { "string", SymbolID::string },
+    { "instructions", SymbolID::instructions },
+    { "samples", SymbolID::samples },
+    { "bits", SymbolID::bits },
+    { "cbits", SymbolID::cbits },
+    { "mask", SymbolID::mask },
+    { "code", SymbolID::code },
+  };
+  auto same_char = [](char a, char b) {
+    return std::tolower((unsigned char)a) == std::tolower((unsigned char)b);
+  };
+  for (auto &sym: kWellKnown) {
+    if (std::ranges::equal(symbol, sym.text_, same_char))
+      return sym.id_;
+  }
+  return SymbolID::other;
+}
+
+/**
+ Read the hash and the text of a symbol form the Package stream.
  \param[in] p package data stream
  \return 0 if succeeded
  */
-int ObjectSymbol::load(PackageBytes &p)
+int ObjectSymbol::load(PackageBytes &p, ObjectArena &)
 {
-  Object::load(p);
+  // class, hash, and at least the trailing NUL
+  if (size_ < 9) {
+    std::cout << "ERROR: Symbol at " << offset_ << " is too short." << std::endl;
+    return kReadOverrun;
+  }
   hash_ = p.get_uint();
   symbol_ = p.get_cstring(size_-8-1);
+  id_ = symbol_id(symbol_);
 #if 0
   uint32_t fpos = p.tell();
   uint32_t apos = (fpos + 7) & ~7;
@@ -438,7 +610,7 @@ int ObjectSymbol::load(PackageBytes &p)
   }
   p.seek_set(fpos);
 #endif
-  return 0;
+  return p.error();
 }
 
 /**
@@ -447,14 +619,12 @@ int ObjectSymbol::load(PackageBytes &p)
  \param[in] p back reference to part data
  \return number of bytes written
  */
-int ObjectSymbol::writeAsm(std::ofstream &f, PartDataNOS &p)
+int ObjectSymbol::writeAsm(AsmWriter &f, PartDataNOS &p)
 {
   static char hex[] = "0123456789ABCDEF";
-  f << "@ ----- " << offset_ << " Symbol (" << size_-9 << " chars)" << std::endl;
+  f << "@ ----- " << offset_ << " Symbol (" << size_-9 << " chars)\n";
   Object::writeAsm(f, p);
-  f << "\t.int\t0x"
-  << std::setw(8) << std::setfill('0') << std::hex << class_ << ", 0x" << hash_ << std::dec
-  << "\t@ hash" << std::endl;
+  f << "\t.int\t0x" << AsmHex(class_, 8) << ", 0x" << AsmHex(hash_) << "\t@ hash\n";
 
   std::string ascii_symbol;
   for (auto c: symbol_) {
@@ -468,10 +638,23 @@ int ObjectSymbol::writeAsm(std::ofstream &f, PartDataNOS &p)
     }
   }
 
-  f << "\t.asciz\t\"" << ascii_symbol << "\"" << std::endl;
+  f << "\t.asciz\t\"" << ascii_symbol << "\"\n";
   return size_;
 }
 
+/**
+ Write a Symbol in binary package format.
+ \param[in] w append the data here
+ \param[in] p back reference to part data
+ */
+void ObjectSymbol::writeBinary(ByteWriter &w, PartDataNOS &p)
+{
+  Object::writeBinary(w, p);
+  w.put_uint(class_);
+  w.put_uint(hash_);
+  w.put_chars(symbol_, symbol_.size() + 1);
+}
+
 /**
  Create an assembler label for this symbol.
 
@@ -486,29 +669,25 @@ int ObjectSymbol::writeAsm(std::ofstream &f, PartDataNOS &p)
  */
 void ObjectSymbol::makeAsmLabel(PartDataNOS &p) {
   static char hex[] = "0123456789ABCDEF";
-  char buf[128];
-//  ::snprintf(buf, 31, "sym_%d_%s", p.index(), label_.c_str());
-  ::snprintf(buf, sizeof(buf)-1, "sym_%d_", p.index());
-  label_ = buf;
-  std::string ascii_label;
+  std::string label = "sym_" + std::to_string(p.index()) + "_";
   for (auto c: symbol_) {
     if ( ::isalnum(c) || (c=='_') ) {
-      label_ += c;
+      label += c;
     } else {
       uint8_t h = (uint8_t)c;
-      label_ += hex[h>>4];
-      label_ += hex[h&0x0f];
+      label += hex[h>>4];
+      label += hex[h&0x0f];
     }
   }
-  if (p.addLabel(label_, this)==false) {
-    strncpy(buf, label_.c_str(), sizeof(buf)-7);
-    int ins = (int)strlen(buf);
+  if (p.addLabel(label, this)==false) {
+    size_t ins = label.size();
     for (int i=2; ; i++) {
-      snprintf(buf+ins, 6, "_%d", i);
-      label_ = buf;
-      if (p.addLabel(label_, this)) break;
+      label.resize(ins);
+      label.append("_").append(std::to_string(i));
+      if (p.addLabel(label, this)) break;
     }
   }
+  label_ = p.arena().copyString(label);
 }
 
 /**
@@ -532,13 +711,20 @@ int ObjectSymbol::compare(Object &other_obj)
   return ret;
 }
 
+/**
+ Add the symbol text to a hash.
+ \param[in] h add to this hash
+ \param[in] p back reference to part data
+ \param[in] deep unused, symbols have no Refs
+ */
+void ObjectSymbol::hash(ContentHasher &h, PartDataNOS &p, bool deep)
+{
+  Object::hash(h, p, deep);
+  h.add(symbol_);
+}
+
 nos::Ref ObjectSymbol::toNOS(PartDataNOS &) {
-  if (nos_object_)
-    return nos::Ref(nos_object_);
-  assert(!marked()); // discover recursion
-  mark(true);
   nos::Ref ret = nos::Sym(symbol());
-  nos_object_ = ret.GetObject();
   return ret;
 }
 
@@ -550,16 +736,19 @@ nos::Ref ObjectSymbol::toNOS(PartDataNOS &) {
  */
 
 /**
- Read a slotted object (Frame or Array) form the Package stream.
+ Read the Refs of a slotted object (Frame or Array) form the Package stream.
  \param[in] p package data stream
  \return 0 if succeeded
  */
-int ObjectSlotted::load(PackageBytes &p)
+int ObjectSlotted::load(PackageBytes &p, ObjectArena &arena)
 {
-  Object::load(p);
-  int i = 0, n = size_/4-1;
-  for ( ; i<n; ++i) {
-    ref_list_.push_back(p.get_ref());
+  int n = (int)(size_/4) - 1;
+  if (n > 0) {
+    ref_list_ = arena.allocateWords(n);
+    if (p.get_refs(ref_list_.data(), n) != 0) {
+      ref_list_ = { };
+      return -1;
+    }
   }
   return 0;
 }
@@ -570,23 +759,37 @@ int ObjectSlotted::load(PackageBytes &p)
  \param[in] p back reference to part data
  \return number of bytes written
  */
-int ObjectSlotted::writeAsm(std::ofstream &f, PartDataNOS &p)
+int ObjectSlotted::writeAsm(AsmWriter &f, PartDataNOS &p)
 {
   if (type_ == 1) {
-    f << "@ ----- " << offset_ << " Array (" << (size_/4)-1 << " entries)" << std::endl;
+    f << "@ ----- " << offset_ << " Array (" << (size_/4)-1 << " entries)\n";
     Object::writeAsm(f, p);
-    f << "\t" << p.asmRef(class_) << "\t@ class" << std::endl;
+    f << "\t" << p.asmRef(class_) << "\t@ class\n";
   } else {
-    f << "@ ----- " << offset_ << " Frame (" << (size_/4)-1 << " entries)" << std::endl;
+    f << "@ ----- " << offset_ << " Frame (" << (size_/4)-1 << " entries)\n";
     Object::writeAsm(f, p);
-    f << "\t" << p.asmRef(class_) << "\t@ map" << std::endl;
+    f << "\t" << p.asmRef(class_) << "\t@ map\n";
   }
   for (auto &ref: ref_list_) {
-    f << "\t" << p.asmRef(ref) << "\t@ ref" << std::endl;
+    f << "\t" << p.asmRef(ref) << "\t@ ref\n";
   }
   return size_;
 }
 
+/**
+ Write a slotted object (a Form or an Array) in binary package format.
+ \param[in] w append the data here
+ \param[in] p back reference to part data
+ */
+void ObjectSlotted::writeBinary(ByteWriter &w, PartDataNOS &p)
+{
+  Object::writeBinary(w, p);
+  w.put_uint(p.binaryRef(class_));
+  for (auto ref: ref_list_) {
+    w.put_uint(p.binaryRef(ref));
+  }
+}
+
 /**
  Compare objects.
  \param[in] other_obj the other object
@@ -597,46 +800,65 @@ int ObjectSlotted::compare(Object &other_obj)
   int ret = compareBase(other_obj);
   if (ret != 0) return ret;
   ObjectSlotted &other = static_cast<ObjectSlotted&>(other_obj);
-  if (ref_list_ != other.ref_list_) {
+  if (!std::ranges::equal(ref_list_, other.ref_list_)) {
     std::cout << "WARNING: Object at " << offset() << ", list of Refs differ!" << std::endl;
     ret = -1;
   }
   return ret;
 }
 
+/**
+ Add the class and all slots to a hash.
+ \param[in] h add to this hash
+ \param[in] p back reference to part data
+ \param[in] deep add the hashes of objects that Refs point to
+ */
+void ObjectSlotted::hash(ContentHasher &h, PartDataNOS &p, bool deep)
+{
+  Object::hash(h, p, deep);
+  h.add((uint32_t)ref_list_.size());
+  for (auto ref: ref_list_)
+    p.hashRef(h, ref, deep);
+}
+
 nos::Ref ObjectSlotted::toNOS(PartDataNOS &p) {
-  if (nos_object_)
-    return nos::Ref(nos_object_);
-  assert(!marked()); // discover recursion
-  mark(true);
   nos::Ref ret = nos::RefNIL;
   if (type_ == 1) {
     nos::Ref class_ref = p.refToNOS(class_);
-    nos::Ref array = nos::AllocateArray(class_ref, 0);
     int i, n = (int)ref_list_.size();
-    for (i=0; i<n; ++i) {
-      nos::Ref value = p.refToNOS(ref_list_[i]);
-      nos::AddArraySlot(array, value);
-    }
-    ret = array;
+    std::vector<nos::Ref> values(n);
+    for (i=0; i<n; ++i)
+      values[i] = p.refToNOS(ref_list_[i]);
+    ret = nos::AllocateArray(class_ref, n, values.data());
   } else if (type_ == 3) {
-    nos::Ref frame = nos::AllocateFrame();
     // TODO: check if class_ is really a map
-    p.refToNOS(class_); // mark as created, it will be linked later if is actually used
+    nos::Ref map_ref = p.refToNOS(class_);
     ObjectMap *map = static_cast<ObjectMap*>(p.object_at(class_));
+    if (!map) {
+      std::cout << "ERROR: Frame at " << offset_ << " has no map!" << std::endl;
+      return nos::RefNIL;
+    }
     map->mark(true);
     int i, n = (int)ref_list_.size();
-    for (i=0; i<n; ++i) {
-      nos::Ref tag = p.refToNOS(map->symbol_at(i));
-      nos::Ref value = p.refToNOS(ref_list_[i]);
-      nos::SetFrameSlot(frame, tag, value);
+    if (map->isMap() && map->sharable(n)) {
+      // All frames with the same map in the package share the converted map
+      std::vector<nos::Ref> values(n);
+      for (i=0; i<n; ++i)
+        values[i] = p.refToNOS(ref_list_[i]);
+      ret = nos::AllocateFrame(map_ref, n, values.data());
+    } else {
+      nos::Ref frame = nos::AllocateFrame(n);
+      for (i=0; i<n; ++i) {
+        nos::Ref tag = p.refToNOS(map->symbol_at(i));
+        nos::Ref value = p.refToNOS(ref_list_[i]);
+        nos::SetFrameSlot(frame, tag, value);
+      }
+      ret = frame;
     }
-    ret = frame;
   } else {
     std::cout << "ERROR: Slotted Object has unknown type!" << std::endl;
     ret = nos::RefNIL;
   }
-  nos_object_ = ret.GetObject();
   return ret;
 }
 
@@ -653,11 +875,11 @@ nos::Ref ObjectSlotted::toNOS(PartDataNOS &p) {
  \param[in] p back reference to part data
  \return number of bytes written
  */
-int ObjectMap::writeAsm(std::ofstream &f, PartDataNOS &p)
+int ObjectMap::writeAsm(AsmWriter &f, PartDataNOS &p)
 {
-  f << "@ ----- " << offset_ << " Map (" << (size_/4)-2 << " entries)" << std::endl;
+  f << "@ ----- " << offset_ << " Map (" << (size_/4)-2 << " entries)\n";
   Object::writeAsm(f, p);
-  f << "\t" << p.asmRef(class_) << "\t@ flags" << std::endl;
+  f << "\t" << p.asmRef(class_) << "\t@ flags\n";
   // Flags can be 1 (kMapSorted), 2(kMapShared), 4 (kMapProto)
   if (((class_>>2) & ~(1+2+4)) != 0)
     std::cout << "WARNING: Unknown map flag set: " << (class_>>2) << std::endl;
@@ -670,15 +892,25 @@ int ObjectMap::writeAsm(std::ofstream &f, PartDataNOS &p)
       f << " to SUPERMAP";
     }
 #endif
-    f << std::endl;
+    f << '\n';
     int i, n = (int)ref_list_.size();
     for (i=1; i<n; ++i) {
-      f << "\t" << p.asmRef(ref_list_[i]) << "\t@ ref" << std::endl;
+      f << "\t" << p.asmRef(ref_list_[i]) << "\t@ ref\n";
     }
   }
   return size_;
 }
 
+/**
+ Check if frames can use this map directly after conversion.
+ \param[in] n_slots number of slots in the frame
+ \return true if the map has no supermap and one tag per slot
+ */
+bool ObjectMap::sharable(int n_slots)
+{
+  return (ref_list_.size() == (size_t)n_slots + 1) && (ref_list_[0] == 0x00000002);
+}
+
 // TODO: supermaps!
 uint32_t ObjectMap::symbol_at(int index)
 {
@@ -689,7 +921,15 @@ uint32_t ObjectMap::symbol_at(int index)
 }
 
 nos::Ref ObjectMap::toNOS(PartDataNOS &p) {
-  return ObjectSlotted::toNOS(p);
+  std::vector<nos::Ref> tags;
+  tags.reserve(ref_list_.size());
+  for (auto ref: ref_list_)
+    tags.push_back(p.refToNOS(ref));
+  nos::Ref map = nos::AllocateMap(p.refToNOS(class_), (nos::Index)tags.size(), tags.data());
+  nos::Map *nos_map = static_cast<nos::Map*>(map.GetObject());
+  nos_map->VerifySorted();
+  nos_map->BuildIndex(nos::Heap::Current());
+  return map;
 }
 
 
@@ -699,15 +939,39 @@ nos::Ref ObjectMap::toNOS(PartDataNOS &p) {
  All the data in a NOS Part of the Package.
  */
 
+/**
+ Create an empty NOS part.
+ \param[in] part_entry the entry in the part directory
+ */
+PartDataNOS::PartDataNOS(PartEntry &part_entry)
+: PartData(part_entry)
+{
+}
+
+/**
+ Release all objects of the part.
+ */
+PartDataNOS::~PartDataNOS() = default;
+
 /**
  Read the NOS Part of the Package as a list of Objects.
+
+ Large parts can be decoded on a thread pool. A quick first pass finds the
+ position of every object, and the objects are then decoded in parallel in
+ chunks. The result is the same as decoding them one by one.
+
+ With kLoadIndexOnly, only the first pass is run. Objects are decoded by
+ objectAtIndex() when they are first needed, so the package data must stay
+ in memory for the lifetime of the part.
+
  \param[in] p package data stream
+ \param[in] load_flags kLoadIndexOnly to decode objects on first access
+ \param[in] pool decode large parts on this thread pool, may be nullptr
  \return 0 if succeeded
  */
-int PartDataNOS::load(PackageBytes &p) {
+int PartDataNOS::load(PackageBytes &p, uint32_t load_flags, ThreadPool *pool) {
   int start = p.tell();
-  int n = start + part_entry_.size();
-  
+
   p.get_uint();
   uint32_t align_bit = p.get_uint();
   if (align_bit & 0x00000001) {
@@ -716,114 +980,468 @@ int PartDataNOS::load(PackageBytes &p) {
   }
   p.seek_set(start);
 
+  part_start_ = start;
+  arena_list_.clear();
+  object_list_.clear();
+  object_info_.clear();
+  object_index_.clear();
+  hash_list_.clear();
+  shape_list_.clear();
+  lazy_bytes_ = nullptr;
+  labels_made_ = false;
+
+  if (load_flags & kLoadIndexOnly) {
+    if (scanObjects(p, object_info_) == 0) {
+      // Keep a small index and a read position of our own. The last entry
+      // in the index marks the end of the part.
+      arena_list_.push_back(std::make_unique<ObjectArena>());
+      object_list_.assign(object_info_.size() - 1, nullptr);
+      lazy_bytes_ = std::make_unique<PackageBytes>();
+      lazy_bytes_->view(p);
+      p.seek_set((int)object_info_.back().offset_);
+      return 0;
+    }
+    object_info_.clear();
+    p.clear_error();
+    p.seek_set(start);
+  }
+
+  // All objects and their payloads live in arenas that are released with
+  // the part.
+  std::vector<ObjectInfo> info;
+  bool parallel = false;
+  if (pool && (pool->size() > 1) && (part_entry_.size() >= 256*1024)
+      && (scanObjects(p, info) == 0)) {
+    // Every task decodes into an arena of its own, so the first arena only
+    // holds the labels and can start small.
+    arena_list_.push_back(std::make_unique<ObjectArena>());
+    if (loadParallel(p, info, *pool) == 0) {
+      parallel = true;
+    } else {
+      // Should not happen, but if the objects don't end where the scan
+      // expected them to, start over and report errors as usual.
+      object_list_.clear();
+      arena_list_.clear();
+      p.clear_error();
+      p.seek_set(start);
+    }
+  }
+  if (!parallel) {
+    // The first block is sized after the part to avoid regrowing
+    arena_list_.push_back(std::make_unique<ObjectArena>(part_entry_.size() * 4));
+    if (loadSequential(p) != 0)
+      return -1;
+  }
+
+  // Objects are stored in the order of their offset. The index has one entry
+  // for every word in the part, holding the object index plus one, so that
+  // finding the object for a Ref is a single array access.
+  object_index_.assign((part_entry_.size() + 3) / 4, 0);
+  for (size_t i=0; i<object_list_.size(); ++i) {
+    uint32_t word = (object_list_[i]->offset() - start) / 4;
+    if (word < object_index_.size())
+      object_index_[word] = (uint32_t)i + 1;
+  }
+
+  for (auto &obj: object_list_) {
+    obj->resolve(*this);
+  }
+  makeAsmLabels();
+
+  return 0;
+}
+
+/**
+ Decode all objects of the part one after the other.
+ \param[in] p package data stream, positioned at the start of the part
+ \return 0 if succeeded
+ */
+int PartDataNOS::loadSequential(PackageBytes &p) {
+  int start = p.tell();
+  int n = start + part_entry_.size();
+  ObjectArena &arena = *arena_list_.front();
   while (p.tell() < n) {
     uint32_t offset = p.tell();
-    auto o = Object::peek(p, offset);
-    o->load(p);
-    object_list_[offset] = o;
+    Object *o = Object::decode(p, offset, arena);
+    if (!o || o->load(p, arena) != 0) {
+      std::cout << "ERROR: Part " << part_entry_.index() << ": object at 0x"
+      << std::setw(8) << std::setfill('0') << std::hex << offset << std::dec
+      << " reaches beyond the end of the package." << std::endl;
+      return -1;
+    }
+    object_list_.push_back(o);
     o->loadPadding(p, start, align_);
   }
+  return 0;
+}
 
-  for (auto &obj: object_list_) {
-    obj.second->makeAsmLabel(*this);
+/**
+ Find the start of every object in the part without decoding the objects.
+
+ This mirrors the number of bytes that load() reads for each type of object,
+ including the padding. Anything unusual makes the scan fail, and the caller
+ then falls back to loadSequential(), which reports the error.
+
+ \param[in] p package data stream, positioned at the start of the part
+ \param[out] info position, header, and class of every object, followed by
+      an entry holding the position after the last object
+ \return 0 if succeeded, -1 if the part must be loaded sequentially
+ */
+int PartDataNOS::scanObjects(PackageBytes &p, std::vector<ObjectInfo> &info) {
+  size_t start = (size_t)p.tell();
+  size_t end = start + part_entry_.size();
+  size_t size = p.size();
+  const uint8_t *data = p.data();
+  size_t pos = start;
+  info.clear();
+  info.reserve(part_entry_.size() / 16);
+  while (pos < end) {
+    if (pos + 12 > size)
+      return -1;
+    uint32_t header = load_be32(data + pos);
+    uint32_t klass = load_be32(data + pos + 8);
+    uint32_t obj_size = header >> 8;
+    uint32_t extent;
+    switch (header & 3) {
+      case 1: case 3: // Array, Frame: the Ref list is read in whole words
+        if (obj_size < 12) return -1;
+        extent = 8 + ((obj_size - 8) & ~3U);
+        break;
+      case 0: // Symbol or Binary
+        if (klass == 0x00055552) {
+          if (obj_size < 17) return -1;
+        } else {
+          if (obj_size < 12) return -1;
+        }
+        extent = obj_size;
+        break;
+      default:
+        return -1;
+    }
+    info.push_back({ (uint32_t)pos, header, klass });
+    pos += extent;
+    pos = start + ((pos - start + align_ - 1) & ~(size_t)(align_ - 1));
+    if (pos > size)
+      return -1;
+  }
+  info.push_back({ (uint32_t)pos, 0, 0 });
+  return 0;
+}
+
+/**
+ Decode the objects found by scanObjects() in parallel.
+
+ Every task decodes a chunk of consecutive objects through its own read
+ position into its own arena, which is sized after the bytes of the chunk.
+
+ \param[in] p package data stream
+ \param[in] info object positions as returned by scanObjects()
+ \param[in] pool run the tasks here
+ \return 0 if succeeded, -1 if any object did not end where expected
+ */
+int PartDataNOS::loadParallel(PackageBytes &p, std::vector<ObjectInfo> &info, ThreadPool &pool) {
+  uint32_t start = part_start_;
+  size_t count = info.size() - 1;
+  size_t n_chunks = std::min(count, (size_t)pool.size() * 4);
+  if (n_chunks == 0)
+    n_chunks = 1;
+  size_t chunk_size = (count + n_chunks - 1) / n_chunks;
+  object_list_.assign(count, nullptr);
+  for (size_t c = 0; c < n_chunks; ++c) {
+    size_t first = std::min(count, c * chunk_size);
+    size_t last = std::min(count, (c + 1) * chunk_size);
+    arena_list_.push_back(std::make_unique<ObjectArena>((size_t)(info[last].offset_ - info[first].offset_) * 4));
+  }
+
+  std::atomic<bool> failed { false };
+  std::latch done((std::ptrdiff_t)n_chunks);
+  for (size_t c = 0; c < n_chunks; ++c) {
+    pool.submit([this, &p, &info, &failed, &done, start, count, chunk_size, c]() {
+      LatchGuard guard(done);
+      // Tasks must not throw, for example when an arena runs out of memory
+      try {
+        PackageBytes bytes;
+        bytes.view(p);
+        ObjectArena &arena = *arena_list_[c + 1];
+        size_t last = std::min(count, (c + 1) * chunk_size);
+        for (size_t i = c * chunk_size; i < last && !failed; ++i) {
+          uint32_t offset = info[i].offset_;
+          bytes.seek_set((int)offset);
+          Object *o = Object::decode(bytes, offset, arena);
+          if (!o || o->load(bytes, arena) != 0) {
+            failed = true;
+            break;
+          }
+          o->loadPadding(bytes, start, align_);
+          if (bytes.error() || ((uint32_t)bytes.tell() != info[i + 1].offset_)) {
+            failed = true;
+            break;
+          }
+          object_list_[i] = o;
+        }
+      } catch (std::exception &) {
+        failed = true;
+      }
+    });
   }
+  done.wait();
+  if (failed)
+    return -1;
+  p.seek_set((int)info.back().offset_);
+  return 0;
+}
 
+/**
+ Decode a single object of a part that was loaded with kLoadIndexOnly.
+ \param[in] ix index of the object
+ \return the object, or nullptr if it could not be decoded
+ */
+Object *PartDataNOS::decodeObject(size_t ix) {
+  PackageBytes &p = *lazy_bytes_;
+  ObjectArena &arena = *arena_list_.front();
+  uint32_t offset = object_info_[ix].offset_;
+  p.clear_error();
+  p.seek_set((int)offset);
+  Object *o = Object::decode(p, offset, arena);
+  if (!o || o->load(p, arena) != 0) {
+    std::cout << "ERROR: Part " << part_entry_.index() << ": object at 0x"
+    << std::setw(8) << std::setfill('0') << std::hex << offset << std::dec
+    << " reaches beyond the end of the package." << std::endl;
+    return nullptr;
+  }
+  o->loadPadding(p, part_start_, align_);
+  object_list_[ix] = o;
+  o->resolve(*this);
+  if (labels_made_)
+    o->makeAsmLabel(*this);
+  return o;
+}
+
+/**
+ Make sure that every object in the part is decoded.
+ Parts that were not loaded with kLoadIndexOnly are always complete.
+ \return 0 if succeeded
+ */
+int PartDataNOS::loadAll() {
+  if (lazy_bytes_) {
+    for (size_t i=0; i<object_list_.size(); ++i) {
+      if (!objectAtIndex(i))
+        return -1;
+    }
+  }
+  makeAsmLabels();
   return 0;
 }
 
+/**
+ Create the assembler labels for all objects, once.
+ Symbol labels must be unique, so they are made in the order of the objects.
+ */
+void PartDataNOS::makeAsmLabels() {
+  if (labels_made_)
+    return;
+  for (auto &obj: object_list_) {
+    obj->makeAsmLabel(*this);
+  }
+  labels_made_ = true;
+}
+
 /**
  Write NOS Package Part data in ARM32 assembler format.
  \param[in] f output stream
  \return number of bytes written
  */
-int PartDataNOS::writeAsm(std::ofstream &f) {
-  f << "@ ===== Part " << part_entry_.index() << " Data NOS" << std::endl;
-  f << "part_" << part_entry_.index() << ":" << std::endl;
-  f << std::endl;
+int PartDataNOS::writeAsm(AsmWriter &f) {
+  if (loadAll() != 0)
+    return -1;
+  f << "@ ===== Part " << part_entry_.index() << " Data NOS\n";
+  f << "part_" << part_entry_.index() << ":\n";
+  f << '\n';
   for (auto &obj: object_list_) {
-    obj.second->writeAsm(f, *this);
-    f << "1:" << std::endl;
+    obj->writeAsm(f, *this);
+    f << "1:\n";
 #if 0
-    write_data(f, obj.second->padding_);
+    write_data(f, obj->padding_);
 #else
     if (align_==4) {
       f << "\t.balign\t4, 0xbf\n";
     } else {
-      int n_fill = (int)obj.second->padding_.size();
+      int n_fill = (int)obj->padding_.size();
       if (n_fill > 0)
         f << "\t.space\t" << n_fill << ", 0xbf\n";
     }
 #endif
   }
-  f << "\t.balign\t4" << std::endl << std::endl;
-  f << "part_" << part_entry_.index() << "_end:" << std::endl;
-  f << "@ ===== Part " << part_entry_.index() << " End" << std::endl << std::endl;
+  f << "\t.balign\t4\n\n";
+  f << "part_" << part_entry_.index() << "_end:\n";
+  f << "@ ===== Part " << part_entry_.index() << " End\n\n";
   return part_entry_.size();
 }
 
+/**
+ Write NOS Package Part data in binary package format.
+
+ Objects may move if the data before them changed in size, so the new
+ position of every object is calculated first, and pointer Refs are then
+ translated while writing.
+
+ \param[in] w append the data here
+ \return number of bytes written
+ */
+int PartDataNOS::writeBinary(ByteWriter &w) {
+  // Padding is rewritten unchanged as long as the object did not move.
+  auto padding_size = [this](Object *obj, size_t pos) -> size_t {
+    if (align_ == 4)
+      return (size_t)(-pos) & 3;
+    return obj->padding_.size();
+  };
+
+  if (loadAll() != 0)
+    return -1;
+
+  size_t start = w.tell();
+  size_t pos = start;
+  binary_offset_.resize(object_list_.size());
+  for (size_t i=0; i<object_list_.size(); ++i) {
+    binary_offset_[i] = (uint32_t)pos;
+    pos += object_list_[i]->binarySize();
+    pos += padding_size(object_list_[i], pos);
+  }
+  w.reserve(pos + 4);
+
+  for (auto obj: object_list_) {
+    obj->writeBinary(w, *this);
+    size_t n_fill = padding_size(obj, w.tell());
+    if (n_fill == obj->padding_.size())
+      w.put_data(obj->padding_);
+    else
+      w.fill(n_fill, (uint8_t)align_fill_);
+  }
+  w.align(4, 0);
+  return (int)(w.tell() - start);
+}
+
+/**
+ Translate a Ref from the original package to the package being written.
+ Only pointers change; all other Refs are returned unmodified.
+ \param[in] ref Ref as found in the original package
+ \return Ref pointing to the new position of the object
+ */
+uint32_t PartDataNOS::binaryRef(uint32_t ref)
+{
+  if ((ref & 3) != 1)
+    return ref;
+  int ix = objectIndex(ref);
+  if (ix < 0 || ix >= (int)binary_offset_.size()) {
+    std::cout << "WARNING: Invalid reference to offset " << (ref&~3) << "." << std::endl;
+    return ref;
+  }
+  return binary_offset_[ix] | 1;
+}
+
+/**
+ Append eight lower case hex digits.
+ */
+static void put_hex8(std::string &d, uint32_t v)
+{
+  static const char hex[] = "0123456789abcdef";
+  for (int i=28; i>=0; i-=4) d += hex[(v>>i) & 15];
+}
+
 /**
  Return the start of an assembler line that will produce the given Ref.
  \param[in] ref a valid Ref
- \return[in] a temporary string with the assembler code
+ \return a view of the assembler code, valid until the next call
  */
-std::string PartDataNOS::asmRef(uint32_t ref)
+std::string_view PartDataNOS::asmRef(uint32_t ref)
 {
-  static char buf[80];
+  // The string keeps its capacity, so this rarely allocates
+  std::string &d = asm_ref_;
+  d.clear();
+  auto put = [&d](std::string_view s) { d.append(s); };
+  auto put_dec = [&d](uint32_t v) {
+    char buf[12];
+    d.append(buf, (size_t)(std::to_chars(buf, buf+sizeof(buf), v).ptr - buf));
+  };
   switch (ref & 3) {
     case 0: // integer
-      ::snprintf(buf, 79, "ref_integer\t%d", ref/4);
+      put("ref_integer\t"); put_dec(ref/4);
       break;
     case 1: // pointer
-      if (object_list_.find(ref&~3) != object_list_.end()) {
-        ::snprintf(buf, 79, "ref_pointer\t%s", object_list_[ref&~3]->label().c_str());
+      if (Object *obj = object_at(ref)) {
+        put("ref_pointer\t"); put(obj->label());
       } else {
         std::cout << "WARNING: Invalid reference to offset " << (ref&~3) << "." << std::endl;
-        ::snprintf(buf, 79, "ref_pointer_invalid\t0x%08x", ref);
+        put("ref_pointer_invalid\t0x"); put_hex8(d, ref);
       }
       break;
     case 2: // special
       if (ref == 2) {
-        ::snprintf(buf, 79, "ref_nil");
+        put("ref_nil");
       } else if (ref == 0x1a) {
-        ::snprintf(buf, 79, "ref_true");
+        put("ref_true");
       } else if ((ref & 15) == 10) {
         uint32_t c = ref >> 4;
-        if (c>=32 && c<127)
-          ::snprintf(buf, 79, "ref_unichar '%c'", (char)c);
-        else
-          ::snprintf(buf, 79, "ref_unichar %d", c);
+        if (c>=32 && c<127) {
+          put("ref_unichar '"); d += (char)c; d += '\'';
+        } else {
+          put("ref_unichar "); put_dec(c);
+        }
       } else {
-        ::snprintf(buf, 79, ".int\t0x%08x", ref);
+        put(".int\t0x"); put_hex8(d, ref);
       }
       break;
     case 3: // magic
-      ::snprintf(buf, 79, "ref_magic\t%d", ref/4);
+      put("ref_magic\t"); put_dec(ref/4);
       break;
   }
-  return std::string(buf);
+  return d;
 }
 
 /**
  Return a symbol from a reference.
  If the Ref is not a symbol, we return an empty string.
  \param[in] ref a valid Ref
- \return[in] a string containing the mixed case symbol text, or empty if ref
+ \return[in] a view of the mixed case symbol text, or empty if ref
       does not reference a symbol
  */
-std::string PartDataNOS::getSymbol(uint32_t ref)
+std::string_view PartDataNOS::getSymbol(uint32_t ref)
 {
-  if ( (ref&3)==1 ) {
-    auto obj_it = object_list_.find(ref&~3);
-    if ( obj_it != object_list_.end() ) {
-      auto up_obj = obj_it->second;
-      Object *obj = &(*obj_it->second);
-      ObjectSymbol *sym = dynamic_cast<ObjectSymbol*>(obj);
-      if (sym) {
-        return sym->symbol();
-      }
-    }
+  ObjectSymbol *sym = symbolAt(ref);
+  return sym ? sym->symbol() : std::string_view();
+}
+
+/**
+ Return the ID of a well known symbol from a reference.
+ \param[in] ref a valid Ref
+ \return the ID of the symbol, or SymbolID::other if ref does not reference
+      a well known symbol
+ */
+SymbolID PartDataNOS::symbolID(uint32_t ref)
+{
+  ObjectSymbol *sym = symbolAt(ref);
+  return sym ? sym->id() : SymbolID::other;
+}
+
+/**
+ Return the symbol object that a Ref points to.
+ \param[in] ref a valid Ref
+ \return the symbol, or nullptr if ref does not reference a symbol
+ */
+ObjectSymbol *PartDataNOS::symbolAt(uint32_t ref)
+{
+  if ((ref&3) != 1)
+    return nullptr;
+  // Don't decode objects that the index already knows are not symbols
+  if (lazy_bytes_) {
+    int ix = objectIndex(ref);
+    if ((ix < 0) || (object_info_[ix].header_ & 3) || (object_info_[ix].class_ != 0x00055552))
+      return nullptr;
   }
-  return std::string("");
+  Object *obj = object_at(ref);
+  if (!obj || !obj->isSymbol())
+    return nullptr;
+  return static_cast<ObjectSymbol*>(obj);
 }
 
 
@@ -856,64 +1474,482 @@ bool PartDataNOS::addLabel(std::string label, ObjectSymbol *symbol) {
 
 /**
  Compare this NOS part with the other NOS part.
+
+ Objects that end before \p first or start at or after \p last are not
+ compared. If the part was loaded with kLoadIndexOnly, they are not even
+ decoded.
+
  \param[in] other_part the other part which must be NOS as well
+ \param[in] first, last range of package offsets that may differ
  \return 0 if they are the same.
  */
-int PartDataNOS::compare(PartData &other_part)
+int PartDataNOS::compare(PartData &other_part, uint32_t first, uint32_t last)
 {
   int ret = 0;
   PartDataNOS &other = static_cast<PartDataNOS&>(other_part);
   if (object_list_.size() != other.object_list_.size()) {
     std::cout << "WARNING: Part " << part_entry_.index() << ", object list sizes differ!" << std::endl;
+    // Objects were inserted or removed, so offsets don't match anymore
+    diff(other);
     return -1;
   }
-  auto other_obj = other.object_list_.begin();
-  for (auto obj = object_list_.begin(); obj != object_list_.end(); ++obj, ++other_obj) {
-    if (obj->second->compare(*other_obj->second) !=0)
+  uint32_t part_end = part_start_ + (uint32_t)part_entry_.size();
+  for (size_t i=0; i<object_list_.size(); ++i) {
+    uint32_t start, end;
+    if (lazy_bytes_) {
+      start = object_info_[i].offset_;
+      end = object_info_[i+1].offset_;
+    } else {
+      start = object_list_[i]->offset();
+      end = (i+1 < object_list_.size()) ? object_list_[i+1]->offset() : part_end;
+    }
+    if ((end <= first) || (start >= last))
+      continue;
+    Object *obj = objectAtIndex(i);
+    Object *other_obj = other.objectAtIndex(i);
+    if (!obj || !other_obj)
+      return -1;
+    if (obj->compare(*other_obj) !=0)
       ret = -1;
   }
   return ret;
 }
 
+/**
+ Add a Ref to the hash of an object.
+ Immediates add their value. Pointers add the hash of the object they point
+ to if \p deep is set, and the same marker for all pointers if not.
+ \param[in] h add to this hash
+ \param[in] ref any Ref in this part
+ \param[in] deep add the hash of the object, see Object::hash()
+ */
+void PartDataNOS::hashRef(ContentHasher &h, uint32_t ref, bool deep)
+{
+  constexpr uint32_t kPointer = 0xFFFFFFF1;
+  constexpr uint32_t kBadPointer = 0xFFFFFFF5;
+  constexpr uint32_t kCycle = 0xFFFFFFF9;
+  if ((ref & 3) != 1) {
+    h.add(ref);
+  } else if (!deep) {
+    h.add(kPointer);
+  } else {
+    int ix = objectIndex(ref);
+    if (ix < 0) {
+      h.add(kBadPointer);
+      h.add(ref);
+    } else if (hash_state_[ix] < 2) {
+      // Objects that point back to an object that is still being hashed
+      // can't include its hash
+      h.add(kCycle);
+    } else {
+      h.add(hash_list_[ix]);
+    }
+  }
+}
 
+/**
+ Find the next object that an object points to, for a GraphWalker.
+ \param[in] node the object
+ \param[inout] i index of the next Ref to check, 0 is the class, followed by
+      the slots; moved past the Ref that was found
+ \param[out] child the object that the Ref points to
+ \param[in] accept called with each object that a Ref points to; objects
+      that are not accepted are skipped
+ \return false if the object has no more pointers to accepted objects
+ */
+template<typename Accept>
+bool PartDataNOS::nextObject(const ObjectNode &node, size_t &i, ObjectNode &child, Accept accept)
+{
+  size_t n = node.refs_.size();
+  while (i <= n) {
+    uint32_t ref = (i == 0) ? node.obj_->classRef() : node.refs_[i-1];
+    ++i;
+    if ((ref & 3) != 1)
+      continue;
+    int child_ix = objectIndex(ref);
+    if (child_ix < 0)
+      continue;
+    Object *child_obj = objectAtIndex((size_t)child_ix);
+    if (child_obj && accept(child_obj, (size_t)child_ix)) {
+      child = ObjectNode(child_obj, (size_t)child_ix);
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ Hash the children of an object before the object itself, see hashObjects().
+ */
+struct PartDataNOS::HashVisitor {
+  PartDataNOS &p;
+  bool enter(const ObjectNode &node) {
+    p.hash_state_[node.ix_] = 1;
+    return true;
+  }
+  bool next(const ObjectNode &node, size_t &i, ObjectNode &child) {
+    return p.nextObject(node, i, child, [this](Object*, size_t ix) {
+      return (p.hash_state_[ix] == 0);
+    });
+  }
+  void leave(const ObjectNode &node) {
+    Object *obj = node.obj_;
+    size_t ix = node.ix_;
+    bool cyclic = false;
+    auto check_cycle = [this, &cyclic](uint32_t ref) {
+      if ((ref & 3) != 1) return;
+      int child = p.objectIndex(ref);
+      if ((child >= 0) && (p.hash_state_[child] != 2)) cyclic = true;
+    };
+    check_cycle(obj->classRef());
+    for (auto ref: obj->refs())
+      check_cycle(ref);
+    ContentHasher deep, shallow;
+    obj->hash(deep, p, true);
+    obj->hash(shallow, p, false);
+    if (cyclic) {
+      // The cycle marker hides what the back reference points to, so the
+      // hash could match an object with different content. Make the hash
+      // unique to this part instead.
+      deep.add(ContentHash { (uint64_t)(uintptr_t)&p, obj->offset() });
+    }
+    p.hash_list_[ix] = deep.finish();
+    p.shape_list_[ix] = shallow.finish();
+    p.hash_state_[ix] = cyclic ? 3 : 2;
+  }
+};
+
+/**
+ Calculate the content hash of every object in this part, once.
+
+ The hash of an object includes the hashes of all objects that it points to,
+ so the objects form a Merkle tree: if two objects have the same hash, the
+ whole tree below them is the same, no matter where the objects are in the
+ package. The objects are visited depth first, children before parents,
+ by a GraphWalker, because book parts can nest very deep.
+
+ \return 0 if succeeded, -1 if an object could not be decoded
+ */
+int PartDataNOS::hashObjects()
+{
+  size_t n = object_list_.size();
+  if (hash_list_.size() == n)
+    return 0;
+  hash_list_.assign(n, ContentHash());
+  shape_list_.assign(n, ContentHash());
+  // 0: not visited, 1: visiting children, 2: done, 3: done, but part of a cycle
+  hash_state_.assign(n, 0);
+
+  HashVisitor visitor { *this };
+  for (size_t root=0; root<n; ++root) {
+    if (hash_state_[root] != 0)
+      continue;
+    Object *obj = objectAtIndex(root);
+    if (!obj) {
+      hash_list_.clear();
+      hash_state_.clear();
+      return -1;
+    }
+    walker_.walk(ObjectNode(obj, root), visitor);
+  }
+  hash_state_.clear();
+  hash_state_.shrink_to_fit();
+  return 0;
+}
+
+/**
+ List the objects that differ between this part and the other part.
+
+ Unlike compare(), objects are matched by their content hash, not by their
+ position. The walk starts at the root objects of both parts and only
+ descends into pairs of objects whose hashes differ, so the work depends on
+ the number of changed objects, not on the size of the part.
+
+ If two objects differ only in the objects they point to, the pointers are
+ followed. If they differ in their own data, they are reported. If an array
+ or frame changes its number of slots, slots that are found in both objects
+ by their hash are considered unchanged, and the others are listed as added
+ or removed.
+
+ \param[in] other_part the other part which must be NOS as well
+ \return number of differences found, or -1 if the parts could not be hashed
+ */
+int PartDataNOS::diff(PartData &other_part)
+{
+  PartDataNOS &other = static_cast<PartDataNOS&>(other_part);
+  if ((hashObjects() != 0) || (other.hashObjects() != 0))
+    return -1;
+  if (object_list_.empty() || other.object_list_.empty())
+    return (object_list_.size() == other.object_list_.size()) ? 0 : 1;
+
+  int n_diff = 0;
+  std::vector<bool> visited(object_list_.size());
+  std::vector<std::pair<int, int>> work { { 0, 0 } };
+  while (!work.empty()) {
+    auto [a, b] = work.back();
+    work.pop_back();
+    if (visited[a] || (hash_list_[a] == other.hash_list_[b]))
+      continue;
+    visited[a] = true;
+    Object *obj = objectAtIndex(a);
+    Object *other_obj = other.objectAtIndex(b);
+    uint32_t class_ref = obj->classRef(), other_class_ref = other_obj->classRef();
+    auto refs = obj->refs(), other_refs = other_obj->refs();
+
+    auto follow = [&](uint32_t ref, uint32_t other_ref) {
+      if ((ref & 3) != 1)
+        return true;
+      int ix = objectIndex(ref), other_ix = other.objectIndex(other_ref);
+      if ((ix < 0) || (other_ix < 0))
+        return false;
+      work.push_back({ ix, other_ix });
+      return true;
+    };
+    bool same_shape = (shape_list_[a] == other.shape_list_[b]);
+    if (same_shape) {
+      // Same data, so the difference is in the objects that this one points to
+      same_shape = follow(class_ref, other_class_ref);
+      for (size_t i=0; same_shape && (i<refs.size()); ++i)
+        same_shape = follow(refs[i], other_refs[i]);
+      if (same_shape)
+        continue;
+    }
+
+    n_diff++;
+    if ((obj->type() != other_obj->type()) || (obj->type() == 0) || (refs.size() == other_refs.size())) {
+      std::cout << "WARNING: Object at " << obj->offset() << " differs from object at "
+      << other_obj->offset() << "!" << std::endl;
+      continue;
+    }
+
+    // Slots were added or removed, so match the slots by their content
+    auto slot_hash = [](PartDataNOS &p, uint32_t ref) {
+      if ((ref & 3) != 1) {
+        ContentHasher h;
+        h.add(ref);
+        return h.finish();
+      }
+      int ix = p.objectIndex(ref);
+      return (ix < 0) ? ContentHash() : p.hash_list_[ix];
+    };
+    std::unordered_multiset<ContentHash, ContentHashKey> other_slots;
+    for (auto ref: other_refs)
+      other_slots.insert(slot_hash(other, ref));
+    int n_removed = 0;
+    for (auto ref: refs) {
+      auto it = other_slots.find(slot_hash(*this, ref));
+      if (it != other_slots.end())
+        other_slots.erase(it);
+      else
+        n_removed++;
+    }
+    std::cout << "WARNING: Object at " << obj->offset() << " differs from object at "
+    << other_obj->offset() << ", " << n_removed << " slots removed, "
+    << other_slots.size() << " slots added!" << std::endl;
+  }
+  return n_diff;
+}
+
+
+/**
+ Find the index of the object that starts at the given offset.
+ \param[in] offset offset in the package, or a pointer Ref
+ \return index into the object list, or -1 if no object starts there
+ */
+int PartDataNOS::objectIndex(uint32_t offset)
+{
+  if (lazy_bytes_) {
+    // The last entry marks the end of the part and is never found.
+    uint32_t pos = offset & ~3;
+    auto last = object_info_.end() - 1;
+    auto it = std::lower_bound(object_info_.begin(), last, pos,
+      [](const ObjectInfo &info, uint32_t v) { return info.offset_ < v; });
+    if ((it == last) || (it->offset_ != pos))
+      return -1;
+    return (int)(it - object_info_.begin());
+  }
+  uint32_t word = ((offset & ~3) - part_start_) / 4;
+  if (word >= object_index_.size())
+    return -1;
+  return (int)object_index_[word] - 1;
+}
+
+/**
+ Find the object that starts at the given offset.
+ \param[in] offset offset in the package, or a pointer Ref
+ \return the object, or nullptr if no object starts there
+ */
 Object *PartDataNOS::object_at(uint32_t offset)
 {
-  return object_list_[offset&~3].get();
+  int ix = objectIndex(offset);
+  return (ix < 0) ? nullptr : objectAtIndex((size_t)ix);
+}
+
+/**
+ Return the object at the given index, decoding it first if needed.
+ \param[in] ix index into the object list
+ \return the object, or nullptr if it could not be decoded
+ */
+Object *PartDataNOS::objectAtIndex(size_t ix)
+{
+  Object *obj = object_list_[ix];
+  if (!obj && lazy_bytes_)
+    obj = decodeObject(ix);
+  return obj;
 }
 
 /**
  Convert this part of the package into a Newton OS object tree.
+
+ If a store is given, objects that were converted before, maybe from another
+ package, are taken from the store, and new objects are created in the store
+ and added to it. The resulting tree shares read-only objects with other
+ trees, see ObjectStore.
+
+ \param[in] store if set, find and keep converted objects here
  \return the object tree or an error code as an integer
  */
-nos::Ref PartDataNOS::toNOS()
+nos::Ref PartDataNOS::toNOS(ObjectStore *store)
 {
   // Mark all objects as not yet written
+  // Forget the previous conversion, its Heap was released
   for (auto &obj: object_list_)
-    obj.second->mark(false);
+    if (obj) obj->resetNOS();
 
   // the first object must be an array with one element that is the root of the tree
   // TODO: many assumptions, no error checking!
-  auto root_it = object_list_.begin();
-  ObjectSlotted *root_obj = static_cast<ObjectSlotted*>(root_it->second.get());
+  if (object_list_.empty())
+    return nos::RefNIL;
+  ObjectSlotted *root_obj = static_cast<ObjectSlotted*>(objectAtIndex(0));
+  if (!root_obj)
+    return nos::RefNIL;
   root_obj->mark(true);
-  uint32_t data_ref = root_obj->slot(0);
-  Object *data_obj = object_at(data_ref);
-  nos::Ref nos_form = data_obj->toNOS(*this);
+
+  if (store && (hashObjects() != 0))
+    store = nullptr;
+  store_ = store;
+  if (store)
+    store_report_ = std::make_unique<ObjectStoreReport>();
+  nos::Ref nos_form;
+  {
+    nos::HeapScope heap_scope(store ? store->heap() : nos::Heap::Current());
+    uint32_t data_ref = root_obj->slot(0);
+    nos_form = refToNOS(data_ref);
+  }
 
   // count the objects that were not written
+  // Objects that were never decoded were not converted either.
   int unmarked = 0;
-  for (auto &obj: object_list_) {
-    if (!obj.second->marked()) {
+  for (size_t i=0; i<object_list_.size(); ++i) {
+    Object *obj = object_list_[i];
+    if (!obj) {
+      unmarked++;
+      std::cout << "Unmarked object at " << object_info_[i].offset_ << std::endl;
+    } else if (!obj->marked()) {
       unmarked++;
-      printf("Unmarked object at %d, %s\n", obj.first, obj.second->label().c_str());
+      std::cout << "Unmarked object at " << obj->offset() << ", " << obj->label() << std::endl;
     }
   }
   if (unmarked > 0)
     std::cout << "WARNING: " << unmarked << " objects not converted!" << std::endl;
 
+  if (store_) {
+    store_->addReport(*store_report_);
+    store_report_ = nullptr;
+    store_ = nullptr;
+  }
   return nos_form;
 }
 
+/**
+ Mark an object and all objects below it as converted, see markTree().
+ */
+struct PartDataNOS::MarkVisitor {
+  PartDataNOS &p;
+  bool enter(const ObjectNode &node) {
+    node.obj_->mark(true);
+    if (p.store_report_)
+      p.store_report_->count(*node.obj_, true);
+    return true;
+  }
+  bool next(const ObjectNode &node, size_t &i, ObjectNode &child) {
+    return p.nextObject(node, i, child, [](Object *obj, size_t) {
+      return !obj->marked();
+    });
+  }
+  void leave(const ObjectNode &) { }
+};
+
+/**
+ Mark an object and all objects that it points to as converted.
+ \param[in] node the object and its index
+ */
+void PartDataNOS::markTree(const ObjectNode &node)
+{
+  MarkVisitor visitor { *this };
+  walker_.walk(node, visitor);
+}
+
+/**
+ Convert the children of an object before the object itself, see refToNOS().
+
+ Objects are marked and flagged as walking when they are entered. A Ref to
+ an object that is still walking points back up the current path. Such
+ cycles can't be created from the bottom up, so the Ref is replaced by NIL.
+
+ If an object store is used, an object that is found in the store is taken
+ from there, and the objects below it are only marked.
+ */
+struct PartDataNOS::ConvertVisitor {
+  PartDataNOS &p;
+  bool enter(const ObjectNode &node) {
+    Object *obj = node.obj_;
+    nos::Ref ret;
+    if (p.store_ && p.store_->find(p.hash_list_[node.ix_], ret)) {
+      // The objects below were not converted, but they are in the tree
+      p.markTree(node);
+      obj->setNOS(ret);
+      return false;
+    }
+    obj->mark(true);
+    obj->setWalking(true);
+    return true;
+  }
+  bool next(const ObjectNode &node, size_t &i, ObjectNode &child) {
+    return p.nextObject(node, i, child, [this, &node](Object *obj, size_t) {
+      if (obj->walking()) {
+        std::cout << "WARNING: Object at " << node.obj_->offset()
+                  << " refers back to object at " << obj->offset() << ", replaced by NIL." << std::endl;
+        return false;
+      }
+      // Objects that were marked by markTree() must be found in the store
+      return !obj->hasNOS() && (!obj->marked() || p.store_);
+    });
+  }
+  void leave(const ObjectNode &node) {
+    Object *obj = node.obj_;
+    nos::Ref ret = obj->toNOS(p);
+    if (p.store_) {
+      ret = p.store_->insert(p.hash_list_[node.ix_], *obj, ret);
+      p.store_report_->count(*obj, false);
+    }
+    obj->setNOS(ret);
+    obj->setWalking(false);
+  }
+};
+
+/**
+ Convert a Ref into a NOS Ref.
+
+ If the Ref points to an object that was not converted yet, the object and
+ all objects below it are converted by a GraphWalker, children first. The
+ Object::toNOS() methods call refToNOS() for their Refs and find them
+ converted already, so conversion never recurses.
+
+ \param[in] ref any Ref in this part
+ \return the converted Ref, or NIL if it points back to an object that is
+      still being converted
+ */
 nos::Ref PartDataNOS::refToNOS(uint32_t ref) {
 //  static char buf[80];
   switch (ref & 3) {
@@ -921,8 +1957,17 @@ nos::Ref PartDataNOS::refToNOS(uint32_t ref) {
       int32_t s = static_cast<int32_t>(ref);
       nos::Integer v = (nos::Integer(s))/4;
       return nos::Ref(v); }
-    case 1: // pointer
-      return object_at(ref)->toNOS(*this);
+    case 1: { // pointer
+      int ix = objectIndex(ref);
+      if (Object *obj = (ix < 0) ? nullptr : objectAtIndex((size_t)ix)) {
+        if (!obj->hasNOS() && !obj->walking() && (store_ || !obj->marked())) {
+          ConvertVisitor visitor { *this };
+          walker_.walk(ObjectNode(obj, (size_t)ix), visitor);
+        }
+        return obj->getNOS();
+      }
+      std::cout << "WARNING: Invalid reference to offset " << (ref&~3) << "." << std::endl;
+      return nos::RefNIL; }
     case 2: // special
       if (ref == 2) {
         return nos::RefNIL;
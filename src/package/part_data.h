@@ -26,12 +26,25 @@
 #include <ios>
 #include <cstdlib>
 #include <vector>
+#include <span>
+#include <string>
+#include <string_view>
 #include <map>
 
+#include "object_arena.h"
+#include "tools/content_hash.h"
+#include "tools/graph_walker.h"
+
+class AsmWriter;
+class ThreadPool;
+
 namespace pkg {
 
 class PartEntry;
+class ObjectStore;
+struct ObjectStoreReport;
 class PackageBytes;
+class ByteWriter;
 
 class PartData {
 protected:
@@ -39,27 +52,37 @@ protected:
 public:
   PartData(PartEntry &part_entry) : part_entry_(part_entry) { }
   virtual ~PartData() = default;
-  virtual int load(PackageBytes &p) = 0;
-  virtual int writeAsm(std::ofstream &f) = 0;
-  virtual int compare(PartData &other);
-  virtual nos::Ref toNOS() { return nos::RefNIL; }
+  virtual int load(PackageBytes &p, uint32_t load_flags, ThreadPool *pool) = 0;
+  virtual int writeAsm(AsmWriter &f) = 0;
+  virtual int writeBinary(ByteWriter &w) = 0;
+  virtual int compare(PartData &other, uint32_t first, uint32_t last);
+  virtual int diff(PartData &other);
+  virtual nos::Ref toNOS(ObjectStore *store) { (void)store; return nos::RefNIL; }
   int index();
 };
 
 class PartDataGeneric : public PartData {
-  std::vector<uint8_t> data_;
+  std::span<const uint8_t> data_;
 public:
   PartDataGeneric(PartEntry &part_entry) : PartData(part_entry) { }
   ~PartDataGeneric() override = default;
-  int load(PackageBytes &p) override;
-  int writeAsm(std::ofstream &f) override;
+  int load(PackageBytes &p, uint32_t load_flags, ThreadPool *pool) override;
+  int writeAsm(AsmWriter &f) override;
+  int writeBinary(ByteWriter &w) override;
 };
 
 class PartDataNOS;
 
+/**
+ Symbols with a known meaning when used as the class of a Binary Object.
+ */
+enum class SymbolID: uint8_t {
+  other, real, string, instructions, samples, bits, cbits, mask, code
+};
+
 class Object {
 protected:
-  std::string label_;
+  std::string_view label_;
   uint32_t offset_{ 0 };
   uint32_t type_ { 0 };
   uint32_t flags_ { 0 };
@@ -67,59 +90,90 @@ protected:
   uint32_t ref_cnt_ { 0 };
   uint32_t class_{ 0 };
   bool mark_ { false };
+  bool walking_ { false };
   nos::Object *nos_object_ { nullptr };
 public: // TODO: hack
-  std::vector<uint8_t> padding_;
+  std::span<const uint8_t> padding_;
 public:
-  static std::shared_ptr<Object> peek(PackageBytes &p, uint32_t offset);
+  static Object *decode(PackageBytes &p, uint32_t offset, ObjectArena &arena);
   Object(uint32_t offset) : offset_(offset) { }
   virtual ~Object() = default;
-  virtual int load(PackageBytes &p);
+  void setHeader(uint32_t header, uint32_t ref_cnt, uint32_t klass);
+  virtual int load(PackageBytes &p, ObjectArena &arena) = 0;
   void loadPadding(PackageBytes &p, uint32_t start, uint32_t align);
-  virtual int writeAsm(std::ofstream &f, PartDataNOS &p);
+  virtual int writeAsm(AsmWriter &f, PartDataNOS &p);
   virtual void makeAsmLabel(PartDataNOS &p);
+  virtual void resolve(PartDataNOS &p) { (void)p; }
+  virtual uint32_t binarySize() const = 0;
+  virtual void writeBinary(ByteWriter &w, PartDataNOS &p);
   virtual int compare(Object &other_obj) = 0;
   virtual nos::Ref toNOS(PartDataNOS &p) = 0;
+  virtual std::span<const uint32_t> refs() const { return { }; }
+  virtual void hash(ContentHasher &h, PartDataNOS &p, bool deep);
   int compareBase(Object &other);
-  std::string &label() { return label_; }
+  std::string_view label() const { return label_; }
   uint32_t type() const { return type_; }
   uint32_t offset() const { return offset_; }
   uint32_t size() const { return size_; }
+  uint32_t classRef() const { return class_; }
+  bool isSymbol() const { return (type_ == 0) && (class_ == 0x00055552); }
+  bool isMap() const { return (type_ == 1) && ((class_ & 0x00000003) == 0); }
   void mark(bool v) { mark_ = v; }
+  void resetNOS() { mark_ = false; walking_ = false; nos_object_ = nullptr; }
+  void setNOS(nos::Ref ref) { mark_ = true; nos_object_ = ref.GetObject(); }
+  bool hasNOS() const { return (nos_object_ != nullptr); }
+  nos::Ref getNOS() const { return nos_object_ ? nos::Ref(nos_object_) : nos::RefNIL; }
   bool marked() { return mark_; }
+  void setWalking(bool v) { walking_ = v; }
+  bool walking() const { return walking_; }
 };
 
 class ObjectBinary : public Object {
-  std::vector<uint8_t> data_;
+  std::span<const uint8_t> data_;
+  SymbolID class_id_ { SymbolID::other };
 public:
   ObjectBinary(uint32_t offset) : Object(offset) { }
-  int load(PackageBytes &p) override;
-  int writeAsm(std::ofstream &f, PartDataNOS &p) override;
+  int load(PackageBytes &p, ObjectArena &arena) override;
+  void resolve(PartDataNOS &p) override;
+  SymbolID classID() const { return class_id_; }
+  int writeAsm(AsmWriter &f, PartDataNOS &p) override;
+  uint32_t binarySize() const override { return 12 + (uint32_t)data_.size(); }
+  void writeBinary(ByteWriter &w, PartDataNOS &p) override;
   int compare(Object &other_obj) override;
+  void hash(ContentHasher &h, PartDataNOS &p, bool deep) override;
   nos::Ref toNOS(PartDataNOS &p) override;
 };
 
 class ObjectSymbol : public Object {
   uint32_t hash_{ 0 };
-  std::string symbol_;
+  std::string_view symbol_;
+  SymbolID id_ { SymbolID::other };
 public:
   ObjectSymbol(uint32_t offset) : Object(offset) { }
-  int load(PackageBytes &p) override;
-  int writeAsm(std::ofstream &f, PartDataNOS &p) override;
+  int load(PackageBytes &p, ObjectArena &arena) override;
+  int writeAsm(AsmWriter &f, PartDataNOS &p) override;
+  uint32_t binarySize() const override { return 17 + (uint32_t)symbol_.size(); }
+  void writeBinary(ByteWriter &w, PartDataNOS &p) override;
   void makeAsmLabel(PartDataNOS &p) override;
   int compare(Object &other_obj) override;
-  std::string symbol() { return symbol_; }
+  void hash(ContentHasher &h, PartDataNOS &p, bool deep) override;
+  std::string_view symbol() const { return symbol_; }
+  SymbolID id() const { return id_; }
   nos::Ref toNOS(PartDataNOS &p) override;
 };
 
 class ObjectSlotted : public Object {
 protected:
-  std::vector<uint32_t> ref_list_;
+  std::span<uint32_t> ref_list_;
 public:
   ObjectSlotted(uint32_t offset) : Object(offset) { }
-  int load(PackageBytes &p) override;
-  int writeAsm(std::ofstream &f, PartDataNOS &p) override;
+  int load(PackageBytes &p, ObjectArena &arena) override;
+  int writeAsm(AsmWriter &f, PartDataNOS &p) override;
+  uint32_t binarySize() const override { return 12 + 4 * (uint32_t)ref_list_.size(); }
+  void writeBinary(ByteWriter &w, PartDataNOS &p) override;
   int compare(Object &other_obj) override;
+  std::span<const uint32_t> refs() const override { return ref_list_; }
+  void hash(ContentHasher &h, PartDataNOS &p, bool deep) override;
   uint32_t slot(int i) { return ref_list_[i]; }
   nos::Ref toNOS(PartDataNOS &p) override;
 };
@@ -128,26 +182,83 @@ class ObjectMap : public ObjectSlotted {
 public:
   ObjectMap(uint32_t offset) : ObjectSlotted(offset) { }
   uint32_t symbol_at(int index);
-  int writeAsm(std::ofstream &f, PartDataNOS &p) override;
+  bool sharable(int n_slots);
+  int writeAsm(AsmWriter &f, PartDataNOS &p) override;
   nos::Ref toNOS(PartDataNOS &p) override;
 };
 
+/**
+ Position and header of an Object, as found by PartDataNOS::scanObjects().
+ */
+struct ObjectInfo {
+  uint32_t offset_ { 0 };
+  uint32_t header_ { 0 };
+  uint32_t class_ { 0 };
+};
+
+/**
+ An object and its index in the part, as visited by a GraphWalker.
+ */
+struct ObjectNode {
+  Object *obj_ { nullptr };
+  size_t ix_ { 0 };
+  std::span<const uint32_t> refs_ { };
+  ObjectNode() = default;
+  ObjectNode(Object *obj, size_t ix) : obj_(obj), ix_(ix), refs_(obj->refs()) { }
+};
+
 class PartDataNOS : public PartData {
-  std::map<uint32_t, std::shared_ptr<Object>> object_list_;
+  std::vector<std::unique_ptr<ObjectArena>> arena_list_;
+  std::vector<Object*> object_list_;
+  std::vector<uint32_t> object_index_;
+  std::vector<ObjectInfo> object_info_;
+  std::vector<ContentHash> hash_list_;
+  std::vector<ContentHash> shape_list_;
+  std::vector<uint8_t> hash_state_;
+  ObjectStore *store_ { nullptr };
+  std::unique_ptr<ObjectStoreReport> store_report_;
+  GraphWalker<ObjectNode> walker_;
+  std::unique_ptr<PackageBytes> lazy_bytes_;
+  bool labels_made_ { false };
+  uint32_t part_start_{ 0 };
+  std::vector<uint32_t> binary_offset_;
+  std::string asm_ref_;
   std::map<std::string, ObjectSymbol*> label_list_;
   uint32_t align_{ 8 };
   uint32_t align_fill_{ 0xadbadbad };
+  int loadSequential(PackageBytes &p);
+  int scanObjects(PackageBytes &p, std::vector<ObjectInfo> &info);
+  int loadParallel(PackageBytes &p, std::vector<ObjectInfo> &info, ThreadPool &pool);
+  Object *decodeObject(size_t ix);
+  int loadAll();
+  void makeAsmLabels();
+  struct HashVisitor;
+  struct MarkVisitor;
+  struct ConvertVisitor;
+  template<typename Accept>
+  bool nextObject(const ObjectNode &node, size_t &i, ObjectNode &child, Accept accept);
+  int hashObjects();
+  void markTree(const ObjectNode &node);
 public:
-  PartDataNOS(PartEntry &part_entry) : PartData(part_entry) { }
-  ~PartDataNOS() override = default;
-  int load(PackageBytes &p) override;
-  int writeAsm(std::ofstream &f) override;
-  std::string asmRef(uint32_t ref);
-  std::string getSymbol(uint32_t ref);
+  PartDataNOS(PartEntry &part_entry);
+  ~PartDataNOS() override;
+  int load(PackageBytes &p, uint32_t load_flags, ThreadPool *pool) override;
+  int writeAsm(AsmWriter &f) override;
+  int writeBinary(ByteWriter &w) override;
+  uint32_t binaryRef(uint32_t ref);
+  ObjectArena &arena() { return *arena_list_.front(); }
+  std::string_view asmRef(uint32_t ref);
+  std::string_view getSymbol(uint32_t ref);
+  SymbolID symbolID(uint32_t ref);
+  ObjectSymbol *symbolAt(uint32_t ref);
   bool addLabel(std::string label, ObjectSymbol *symbol);
-  int compare(PartData &other_part) override;
+  int compare(PartData &other_part, uint32_t first, uint32_t last) override;
+  int diff(PartData &other_part) override;
+  void hashRef(ContentHasher &h, uint32_t ref, bool deep);
   Object *object_at(uint32_t offset);
-  nos::Ref toNOS() override;
+  Object *objectAtIndex(size_t ix);
+  int objectIndex(uint32_t offset);
+  nos::Ref toNOS(ObjectStore *store) override;
   nos::Ref refToNOS(uint32_t ref);
 };
 
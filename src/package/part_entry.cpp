@@ -20,6 +20,8 @@
 #include "part_entry.h"
 
 #include "package_bytes.h"
+#include "byte_writer.h"
+#include "tools/asm_writer.h"
 #include "part_data.h"
 
 #include "nos/objects.h"
@@ -124,10 +126,44 @@ int PartEntry::loadInfo(PackageBytes &p) {
 /**
  Read the part data using an interpreter for the format as set in the flags.
  \param[in] p package data stream
+ \param[in] load_flags kLoadIndexOnly is handed on to the part data
+ \param[in] pool decode large parts on this thread pool, may be nullptr
  \return 0 if succeeded
  */
-int PartEntry::loadPartData(PackageBytes &p) {
-  return part_data_->load(p);
+int PartEntry::loadPartData(PackageBytes &p, uint32_t load_flags, ThreadPool *pool) {
+  deferred_bytes_ = nullptr;
+  int ret = part_data_->load(p, load_flags, pool);
+  part_data_error_ = (ret != 0);
+  return ret;
+}
+
+/**
+ Remember where the part data is, but don't read it until it is needed.
+ \param[in] p package data, kept alive until the part data is loaded
+ \param[in] part_data_start offset of the first part in the package data;
+      the offset in this entry is relative to that
+ \param[in] load_flags used when the part data is loaded
+ */
+void PartEntry::deferPartData(std::shared_ptr<PackageBytes> p, uint32_t part_data_start, uint32_t load_flags) {
+  deferred_bytes_ = p;
+  deferred_start_ = part_data_start;
+  deferred_flags_ = load_flags;
+}
+
+/**
+ Access the part data, loading it first if loading was deferred.
+ \note Deferred loading moves the read position in the shared package data,
+      so parts must not be loaded from multiple threads at the same time.
+ \return the part data, or nullptr if it could not be loaded
+ */
+PartData *PartEntry::partData() {
+  if (deferred_bytes_) {
+    auto p = deferred_bytes_;
+    p->clear_error();
+    p->seek_set((int)(deferred_start_ + offset_));
+    loadPartData(*p, deferred_flags_, nullptr);
+  }
+  return part_data_error_ ? nullptr : part_data_.get();
 }
 
 /**
@@ -135,21 +171,21 @@ int PartEntry::loadPartData(PackageBytes &p) {
  \param[in] f output stream
  \return number of bytes written
  */
-int PartEntry::writeAsm(std::ofstream &f) {
-  f << "@ ===== Part Entry " << index_ << std::endl;
-  f << "\t.int\t" << offset_ << "\t@ offset" << std::endl;
+int PartEntry::writeAsm(AsmWriter &f) {
+  f << "@ ===== Part Entry " << index_ << '\n';
+  f << "\t.int\t" << offset_ << "\t@ offset\n";
 #if 0
-  f << "\t.int\t" << size_ << "\t@ size" << std::endl;
-  f << "\t.int\t" << size2_ << "\t@ size2" << std::endl;
+  f << "\t.int\t" << size_ << "\t@ size\n";
+  f << "\t.int\t" << size2_ << "\t@ size2\n";
 #else
-  f << "\t.int\tpart_" << index() << "_end-part_" << index() << "\t@ size" << std::endl;
-  f << "\t.int\tpart_" << index() << "_end-part_" << index() << "\t@ size2" << std::endl;
+  f << "\t.int\tpart_" << index() << "_end-part_" << index() << "\t@ size\n";
+  f << "\t.int\tpart_" << index() << "_end-part_" << index() << "\t@ size2\n";
 #endif
   f << "\t.ascii\t\"" << type_ << "\"\t@ type\n";
-  f << "\t.int\t" << reserved_ << "\t@ reserved" << std::endl;
-  f << "\t.int\t0x" << std::setw(8) << std::setfill('0') << std::hex << flags_ << std::dec << "\t@ flags\n";
+  f << "\t.int\t" << reserved_ << "\t@ reserved\n";
+  f << "\t.int\t0x" << AsmHex(flags_, 8) << "\t@ flags\n";
   static const std::string lut[] = { "kProtocolPart", "kNOSPart", "kRawPart", "UNKNOWN"};
-  f << "\t\t@ " << lut[flags_ & 3] << std::endl;
+  f << "\t\t@ " << lut[flags_ & 3] << '\n';
   if (flags_ & 0x000001f0) {
     f << "\t\t@";
     if (flags_ & 0x00000010) f << " kAutoLoadPartFlag";
@@ -157,19 +193,17 @@ int PartEntry::writeAsm(std::ofstream &f) {
     if (flags_ & 0x00000040) f << " kCompressedFlag";
     if (flags_ & 0x00000080) f << " kNotifyFlag";
     if (flags_ & 0x00000100) f << " kAutoCopyFlag";
-    f << std::endl;
+    f << '\n';
   }
   if (flags_ & 0xfffffe0c)
-    f << "\t@ WARNING unknown flag: "
-    << std::setw(8) << std::setfill('0') << std::hex
-    << (flags_ & 0xfffffe0c) << std::dec << std::endl;
+    f << "\t@ WARNING unknown flag: " << AsmHex(flags_ & 0xfffffe0c, 8) << '\n';
 #if 0
-  f << "\t.short\t" << info_offset_ << ", " << info_length_ << "\t@ info" << std::endl;
+  f << "\t.short\t" << info_offset_ << ", " << info_length_ << "\t@ info\n";
 #else
-  f << "\t.short\tpart" << index_ << "info_start, part" << index_ << "info_end-part" << index_ << "info_start\t@ info" << std::endl;
+  f << "\t.short\tpart" << index_ << "info_start, part" << index_ << "info_end-part" << index_ << "info_start\t@ info\n";
 #endif
-  f << "\t.short\t" << compressor_offset_ << ", " << compressor_length_ << "\t@ compressor" << std::endl;
-  f << std::endl;
+  f << "\t.short\t" << compressor_offset_ << ", " << compressor_length_ << "\t@ compressor\n";
+  f << '\n';
   return 32;
 }
 
@@ -178,12 +212,12 @@ int PartEntry::writeAsm(std::ofstream &f) {
  \param[in] f output stream
  \return number of bytes written
  */
-int PartEntry::writeAsmInfo(std::ofstream &f) {
-  f << "@ ----- Part " << index_ << " Info" << std::endl;
-  f << "part" << index_ << "info_start:" << std::endl;
+int PartEntry::writeAsmInfo(AsmWriter &f) {
+  f << "@ ----- Part " << index_ << " Info\n";
+  f << "part" << index_ << "info_start:\n";
   if (info_length_)
-    f << "\t.ascii\t\"" << info_ << "\"\t@ info" << std::endl;
-  f << "part" << index_ << "info_end:" << std::endl << std::endl;
+    f << "\t.ascii\t\"" << info_ << "\"\t@ info\n";
+  f << "part" << index_ << "info_end:\n\n";
   return info_length_;
 }
 
@@ -192,16 +226,78 @@ int PartEntry::writeAsmInfo(std::ofstream &f) {
  \param[in] f output stream
  \return number of bytes written
  */
-int PartEntry::writeAsmPartData(std::ofstream &f) {
-  return part_data_->writeAsm(f);
+int PartEntry::writeAsmPartData(AsmWriter &f) {
+  PartData *data = partData();
+  if (!data)
+    return -1;
+  return data->writeAsm(f);
+}
+
+/**
+ Write the Package Part attributes in binary package format.
+ The offset, size, and info location are not known yet and are patched by
+ writeBinaryInfo() and writeBinaryPartData().
+ \param[in] w append the data here
+ \return number of bytes written
+ */
+int PartEntry::writeBinary(ByteWriter &w) {
+  binary_entry_pos_ = w.tell();
+  w.put_uint(0);              // offset
+  w.put_uint(0);              // size
+  w.put_uint(0);              // size2
+  w.put_chars(type_, 4);
+  w.put_uint(reserved_);
+  w.put_uint(flags_);
+  w.put_ushort(info_offset_);
+  w.put_ushort(info_length_);
+  w.put_ushort(compressor_offset_);
+  w.put_ushort(compressor_length_);
+  return 32;
+}
+
+/**
+ Write the optional Info field in binary package format.
+ An empty Info field keeps its original offset, since it points nowhere.
+ \param[in] w append the data here
+ \param[in] vdata_start position of the variable length data in the package
+ \return number of bytes written
+ */
+int PartEntry::writeBinaryInfo(ByteWriter &w, size_t vdata_start) {
+  if (info_length_) {
+    w.patch_ushort(binary_entry_pos_ + 24, (uint16_t)(w.tell() - vdata_start));
+    w.put_chars(info_, info_length_);
+  }
+  return info_length_;
+}
+
+/**
+ Write the Part Data in binary package format.
+ \param[in] w append the data here
+ \param[in] part_data_start position of the first part in the package
+ \return number of bytes written, or -1 if the part data could not be loaded
+ */
+int PartEntry::writeBinaryPartData(ByteWriter &w, size_t part_data_start) {
+  PartData *data = partData();
+  if (!data)
+    return -1;
+  size_t start = w.tell();
+  if (data->writeBinary(w) < 0)
+    return -1;
+  uint32_t size = (uint32_t)(w.tell() - start);
+  w.patch_uint(binary_entry_pos_ + 0, (uint32_t)(start - part_data_start));
+  w.patch_uint(binary_entry_pos_ + 4, size);
+  w.patch_uint(binary_entry_pos_ + 8, size);
+  return (int)size;
 }
 
 /**
  Compare this part entry with the other part entry.
  \param[in] other the other part entry
+ \param[in] first, last only part data between these package offsets can
+      differ, the rest is known to be identical
  \return 0 if they are the same.
  */
-int PartEntry::compare(PartEntry &other)
+int PartEntry::compare(PartEntry &other, uint32_t first, uint32_t last)
 {
   int ret = 0;
   if (size_ != other.size_) {
@@ -223,14 +319,41 @@ int PartEntry::compare(PartEntry &other)
   if (ret != 0)
     return ret;
 
-  return part_data_->compare(*other.part_data_);
+  PartData *data = partData();
+  PartData *other_data = other.partData();
+  if (!data || !other_data) {
+    std::cout << "WARNING: Part " << index_ << ", part data could not be loaded!" << std::endl;
+    return -1;
+  }
+  return data->compare(*other_data, first, last);
+}
+
+/**
+ List the differences between the data of this part and the other part.
+ \param[in] other the other part entry
+ \return number of differences found, or -1 if the parts can't be compared
+ */
+int PartEntry::diff(PartEntry &other)
+{
+  if (type_ != other.type_) {
+    std::cout << "WARNING: Part " << index_ << ", types differ!" << std::endl;
+    return -1;
+  }
+  PartData *data = partData();
+  PartData *other_data = other.partData();
+  if (!data || !other_data) {
+    std::cout << "WARNING: Part " << index_ << ", part data could not be loaded!" << std::endl;
+    return -1;
+  }
+  return data->diff(*other_data);
 }
 
 /**
  Convert this part of the package into a Newton OS object tree.
+ \param[in] store if set, reuse objects from this store, see PartDataNOS::toNOS()
  \return the object tree or an error code as an integer
  */
-nos::Ref PartEntry::toNOS() {
+nos::Ref PartEntry::toNOS(ObjectStore *store) {
   auto part = nos::AllocateFrame();
   nos::SetFrameSlot(part, nos::Sym("type"), nos::MakeString(type_));
   nos::SetFrameSlot(part, nos::Sym("flags"), (int)flags_);
@@ -243,7 +366,11 @@ nos::Ref PartEntry::toNOS() {
                         nos::MakeString("WARNING: Protocol Parts not yet understood."));
       break;
     case 1: // kNOSPart
-      nos::SetFrameSlot(part, nos::Sym("data"), part_data_->toNOS());
+      if (PartData *data = partData())
+        nos::SetFrameSlot(part, nos::Sym("data"), data->toNOS(store));
+      else
+        nos::SetFrameSlot(part, nos::Sym("warning"),
+                          nos::MakeString("ERROR: Part data could not be loaded."));
       break;
     case 2: // kRawPart
       nos::SetFrameSlot(part, nos::Sym("warning"),
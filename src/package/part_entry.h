@@ -27,11 +27,17 @@
 #include <fstream>
 #include <ios>
 #include <cstdlib>
+#include <memory>
+
+class AsmWriter;
+class ThreadPool;
 
 namespace pkg {
 
 class PartData;
+class ObjectStore;
 class PackageBytes;
+class ByteWriter;
 
 class PartEntry {
   int index_;
@@ -47,18 +53,34 @@ class PartEntry {
   uint16_t compressor_length_ {0};
   std::string info_;
   std::shared_ptr<PartData> part_data_;
+  std::shared_ptr<PackageBytes> deferred_bytes_;
+  uint32_t deferred_start_ {0};
+  uint32_t deferred_flags_ {0};
+  bool part_data_error_ {false};
+  size_t binary_entry_pos_ {0};
 public:
   PartEntry(int ix);
   int size();
   int index();
+  uint32_t offset() const { return offset_; }
+  const std::string &type() const { return type_; }
+  uint32_t flags() const { return flags_; }
+  const std::string &info() const { return info_; }
   int load(PackageBytes &p);
   int loadInfo(PackageBytes &p);
-  int loadPartData(PackageBytes &p);
-  int writeAsm(std::ofstream &f);
-  int writeAsmInfo(std::ofstream &f);
-  int writeAsmPartData(std::ofstream &f);
-  int compare(PartEntry &other);
-  nos::Ref toNOS();
+  int loadPartData(PackageBytes &p, uint32_t load_flags, ThreadPool *pool);
+  void deferPartData(std::shared_ptr<PackageBytes> p, uint32_t part_data_start, uint32_t load_flags);
+  bool partDataLoaded() const { return !deferred_bytes_; }
+  PartData *partData();
+  int writeAsm(AsmWriter &f);
+  int writeAsmInfo(AsmWriter &f);
+  int writeAsmPartData(AsmWriter &f);
+  int writeBinary(ByteWriter &w);
+  int writeBinaryInfo(ByteWriter &w, size_t vdata_start);
+  int writeBinaryPartData(ByteWriter &w, size_t part_data_start);
+  int compare(PartEntry &other, uint32_t first, uint32_t last);
+  int diff(PartEntry &other);
+  nos::Ref toNOS(ObjectStore *store);
 };
 
 } // namespace pkg
@@ -20,7 +20,9 @@
 #include "relocation_data.h"
 
 #include "package_bytes.h"
+#include "byte_writer.h"
 #include "tools/tools.h"
+#include "tools/asm_writer.h"
 
 using namespace pkg;
 
@@ -44,7 +46,7 @@ int RelocationSet::load(PackageBytes &p)
   uint32_t apos = (fpos + 3) & ~3;
   uint32_t n = apos - fpos;
   padding_ = p.get_data(n);
-  return 0;
+  return p.error();
 }
 
 /**
@@ -56,17 +58,31 @@ int RelocationSet::load(PackageBytes &p)
  \param[in] f write to this text stream
  \return number of bytes converted to assembler
  */
-int RelocationSet::writeAsm(std::ofstream &f)
+int RelocationSet::writeAsm(AsmWriter &f)
 {
-  f << "@ ----- Relocation Set" << std::endl;
-  f << "\t.short\t" << (int)page_number_ << "\t@ page_number" << std::endl;
-  f << "\t.short\t" << (int)offset_count_ << "\t@ offset_count_" << std::endl;
+  f << "@ ----- Relocation Set\n";
+  f << "\t.short\t" << (int)page_number_ << "\t@ page_number\n";
+  f << "\t.short\t" << (int)offset_count_ << "\t@ offset_count_\n";
   for (auto o: offset_list_) {
     int offset_in_part_data = o*4 + page_number_*1024;
-    f << "\t.byte\t" << (int)o << "\t@ relocate word at " << offset_in_part_data << std::endl;
+    f << "\t.byte\t" << (int)o << "\t@ relocate word at " << offset_in_part_data << '\n';
   }
   write_data(f, padding_);
-  f << std::endl;
+  f << '\n';
+  return (int)(4 + offset_list_.size() + padding_.size());
+}
+
+/**
+ Write the relocation set in binary package format.
+ \param[in] w append the data here
+ \return number of bytes written
+ */
+int RelocationSet::writeBinary(ByteWriter &w)
+{
+  w.put_ushort(page_number_);
+  w.put_ushort(offset_count_);
+  w.put_data(offset_list_);
+  w.put_data(padding_);
   return (int)(4 + offset_list_.size() + padding_.size());
 }
 
@@ -94,6 +110,10 @@ int RelocationData::load(PackageBytes &p) {
     if (result != 0)
       return -1;
   }
+  if (p.error() != 0) {
+    std::cout << "ERROR: Relocation Data reaches beyond the end of the package." << std::endl;
+    return -1;
+  }
   int pading_size_ = start + size_ - p.tell();
   if (pading_size_ > 0) {
     padding_ = p.get_data(pading_size_);
@@ -101,7 +121,7 @@ int RelocationData::load(PackageBytes &p) {
     std::cout << "ERROR: Relocation Data padding is negative." << std::endl;
     return -1;
   }
-  return 0;
+  return p.error();
 }
 
 /**
@@ -110,18 +130,36 @@ int RelocationData::load(PackageBytes &p) {
  \param[in] f output stream
  \return number of bytes written
  */
-int RelocationData::writeAsm(std::ofstream &f) {
-  f << "@ ===== Relocation Data" << std::endl;
-  f << "\t.int\t" << reserved_ << "\t@ reserved" << std::endl;
-  f << "\t.int\t" << size_ << "\t@ size" << std::endl;
-  f << "\t.int\t" << page_size_ << "\t@ page_size" << std::endl;
-  f << "\t.int\t" << num_entries_ << "\t@ num_entries" << std::endl;
-  f << "\t.int\t" << base_address_ << "\t@ base_address" << std::endl;
+int RelocationData::writeAsm(AsmWriter &f) {
+  f << "@ ===== Relocation Data\n";
+  f << "\t.int\t" << reserved_ << "\t@ reserved\n";
+  f << "\t.int\t" << size_ << "\t@ size\n";
+  f << "\t.int\t" << page_size_ << "\t@ page_size\n";
+  f << "\t.int\t" << num_entries_ << "\t@ num_entries\n";
+  f << "\t.int\t" << base_address_ << "\t@ base_address\n";
   for (auto &set: relocation_set_list_) {
     set.writeAsm(f);
   }
   write_data(f, padding_);
-  f << std::endl;
+  f << '\n';
+  return size_;
+}
+
+/**
+ Write relocation data in binary package format.
+ \param[in] w append the data here
+ \return number of bytes written
+ */
+int RelocationData::writeBinary(ByteWriter &w) {
+  w.put_uint(reserved_);
+  w.put_uint(size_);
+  w.put_uint(page_size_);
+  w.put_uint(num_entries_);
+  w.put_uint(base_address_);
+  for (auto &set: relocation_set_list_) {
+    set.writeBinary(w);
+  }
+  w.put_data(padding_);
   return size_;
 }
 
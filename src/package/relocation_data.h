@@ -24,20 +24,26 @@
 #include <fstream>
 #include <ios>
 #include <cstdlib>
+#include <vector>
+#include <span>
+
+class AsmWriter;
 
 namespace pkg {
 
 class PackageBytes;
+class ByteWriter;
 
 class RelocationSet {
   uint16_t page_number_{ 0 };
   uint16_t offset_count_{ 0 };
-  std::vector<uint8_t> offset_list_;
-  std::vector<uint8_t> padding_;
+  std::span<const uint8_t> offset_list_;
+  std::span<const uint8_t> padding_;
 public:
   RelocationSet() = default;
   int load(PackageBytes &p);
-  int writeAsm(std::ofstream &f);
+  int writeAsm(AsmWriter &f);
+  int writeBinary(ByteWriter &w);
 };
 
 class RelocationData {
@@ -47,11 +53,12 @@ class RelocationData {
   uint32_t num_entries_ {0};
   uint32_t base_address_ {0};
   std::vector<RelocationSet> relocation_set_list_;
-  std::vector<uint8_t> padding_;
+  std::span<const uint8_t> padding_;
 public:
   RelocationData() = default;
   int load(PackageBytes &p);
-  int writeAsm(std::ofstream &f);
+  int writeAsm(AsmWriter &f);
+  int writeBinary(ByteWriter &w);
 };
 
 } // namespace pkg
@@ -0,0 +1,123 @@
+/*
+ * newtfmt, working title, a Newton Script file reader and writer
+ * Copyright (C) 2025  Matthias Melcher
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "asm_writer.h"
+
+#include <cstdio>
+
+/** \class AsmWriter
+ Collect assembler source text in a large buffer.
+
+ All writeAsm() methods generate many small pieces of text. Writing them
+ to a std::ofstream one by one is slow, and the stream formatting state
+ must be managed carefully. AsmWriter formats numbers with std::to_chars,
+ has no formatting state, and hands the text to the output stream in large
+ blocks.
+
+ A writer without an output stream keeps all text in memory, so that
+ multiple parts can be rendered independently and joined later.
+ */
+
+/**
+ Create a writer that keeps all text in memory.
+ \param[in] capacity initial size of the buffer
+ */
+AsmWriter::AsmWriter(size_t capacity)
+{
+  buffer_.reserve(capacity);
+}
+
+/**
+ Create a writer that sends its text to an output stream.
+ \param[in] out the output stream
+ \param[in] capacity text is sent to the stream whenever this many bytes
+      were collected
+ */
+AsmWriter::AsmWriter(std::ostream &out, size_t capacity)
+: out_(&out),
+  flush_size_(capacity)
+{
+  buffer_.reserve(capacity + 256);
+}
+
+/**
+ Send the remaining text to the output stream.
+ */
+AsmWriter::~AsmWriter()
+{
+  flush();
+}
+
+/**
+ Send all collected text to the output stream, if there is one.
+ */
+void AsmWriter::flush()
+{
+  if (out_ && !buffer_.empty()) {
+    out_->write(buffer_.data(), (std::streamsize)buffer_.size());
+    buffer_.clear();
+  }
+}
+
+/**
+ Send a large block of text directly to the output stream, for example the
+ text of a part that was rendered by another writer.
+ */
+void AsmWriter::putLarge(std::string_view s)
+{
+  flush();
+  out_->write(s.data(), (std::streamsize)s.size());
+}
+
+/**
+ Append digits, right aligned in a field of the given width.
+ */
+void AsmWriter::putPadded(std::string_view digits, int width, char fill)
+{
+  if ((int)digits.size() < width)
+    buffer_.append((size_t)width - digits.size(), fill);
+  *this << digits;
+}
+
+/**
+ Write a floating point value in the same format as std::ostream does.
+ */
+AsmWriter &AsmWriter::operator<<(double v)
+{
+  char buf[32];
+  int n = ::snprintf(buf, sizeof(buf), "%g", v);
+  return *this << std::string_view(buf, (size_t)n);
+}
+
+AsmWriter &AsmWriter::operator<<(AsmHex v)
+{
+  char buf[24];
+  auto r = std::to_chars(buf, buf + sizeof(buf), v.value_, 16);
+  putPadded(std::string_view(buf, (size_t)(r.ptr - buf)), v.width_, '0');
+  return *this;
+}
+
+AsmWriter &AsmWriter::operator<<(AsmDec v)
+{
+  char buf[24];
+  auto r = std::to_chars(buf, buf + sizeof(buf), v.value_);
+  putPadded(std::string_view(buf, (size_t)(r.ptr - buf)), v.width_, ' ');
+  return *this;
+}
+
@@ -0,0 +1,93 @@
+/*
+ * newtfmt, working title, a Newton Script file reader and writer
+ * Copyright (C) 2025  Matthias Melcher
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef NEWTFMT_TOOLS_ASM_WRITER_H
+#define NEWTFMT_TOOLS_ASM_WRITER_H
+
+#include <charconv>
+#include <concepts>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+/**
+ Write an unsigned integer as hexadecimal digits, with leading zeros up to
+ the given width.
+ */
+struct AsmHex {
+  uint64_t value_;
+  int width_ { 0 };
+  AsmHex(uint64_t value, int width = 0) : value_(value), width_(width) { }
+};
+
+/**
+ Write an integer as decimal digits, right aligned in a field of spaces of
+ the given width.
+ */
+struct AsmDec {
+  int64_t value_;
+  int width_ { 0 };
+  AsmDec(int64_t value, int width = 0) : value_(value), width_(width) { }
+};
+
+class AsmWriter
+{
+  std::string buffer_ { };
+  std::ostream *out_ { nullptr };
+  size_t flush_size_ { 0 };
+
+  void flushIfFull() { if (out_ && buffer_.size() >= flush_size_) flush(); }
+  void putPadded(std::string_view digits, int width, char fill);
+  void putLarge(std::string_view s);
+
+public:
+  AsmWriter(size_t capacity = 64*1024);
+  AsmWriter(std::ostream &out, size_t capacity = 1024*1024);
+  ~AsmWriter();
+  AsmWriter(AsmWriter const& rhs) = delete;
+  AsmWriter& operator=(AsmWriter const& rhs) = delete;
+
+  void flush();
+  std::string_view view() const { return buffer_; }
+  std::string &buffer() { return buffer_; }
+
+  AsmWriter &operator<<(char c) { buffer_.push_back(c); flushIfFull(); return *this; }
+  AsmWriter &operator<<(signed char c) { return *this << (char)c; }
+  AsmWriter &operator<<(unsigned char c) { return *this << (char)c; }
+  AsmWriter &operator<<(std::string_view s) {
+    if (out_ && s.size() >= flush_size_) { putLarge(s); return *this; }
+    buffer_.append(s); flushIfFull(); return *this;
+  }
+  AsmWriter &operator<<(const char *s) { return *this << std::string_view(s); }
+  AsmWriter &operator<<(const std::string &s) { return *this << std::string_view(s); }
+  AsmWriter &operator<<(double v);
+  AsmWriter &operator<<(AsmHex v);
+  AsmWriter &operator<<(AsmDec v);
+
+  template<std::integral T>
+  AsmWriter &operator<<(T v) {
+    char buf[24];
+    auto r = std::to_chars(buf, buf + sizeof(buf), v);
+    return *this << std::string_view(buf, (size_t)(r.ptr - buf));
+  }
+};
+
+#endif // NEWTFMT_TOOLS_ASM_WRITER_H
+
@@ -0,0 +1,88 @@
+/*
+ * newtfmt, working title, a Newton Script file reader and writer
+ * Copyright (C) 2025  Matthias Melcher
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "content_hash.h"
+
+#include <cstring>
+
+/** \class ContentHasher
+ Calculate a 128 bit hash over a sequence of words and blocks of data.
+
+ Two independent 64 bit lanes are mixed with multiply and rotate steps, in
+ the spirit of xxHash, and run through a final avalanche. This is fast and
+ spreads well, but it is not a cryptographic hash.
+
+ The hash depends on the order and the kind of everything that is added:
+ a block of data also adds its length, so that two blocks can't be mistaken
+ for one.
+ */
+
+uint64_t ContentHasher::avalanche(uint64_t v)
+{
+  v ^= v >> 33;
+  v *= kPrime2;
+  v ^= v >> 29;
+  v *= kPrime3;
+  v ^= v >> 32;
+  return v;
+}
+
+/**
+ Add a block of data and its size.
+ */
+void ContentHasher::add(std::span<const uint8_t> data)
+{
+  mix(data.size() ^ 0xA5A5A5A500000000ULL);
+  const uint8_t *src = data.data();
+  size_t n = data.size();
+  for ( ; n >= 8; n -= 8, src += 8) {
+    uint64_t v;
+    ::memcpy(&v, src, 8);
+    mix(v);
+  }
+  if (n > 0) {
+    uint64_t v = 0;
+    ::memcpy(&v, src, n);
+    mix(v);
+  }
+}
+
+/**
+ Add the bytes of a text and its length.
+ */
+void ContentHasher::add(std::string_view text)
+{
+  add(std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(text.data()), text.size()));
+}
+
+/**
+ Get the hash of everything added so far.
+ The hasher is not changed and more content can be added later.
+ \return the hash, which is never all zeros
+ */
+ContentHash ContentHasher::finish() const
+{
+  ContentHash h;
+  h.lo_ = avalanche(a_ ^ (count_ * kPrime3));
+  h.hi_ = avalanche(b_ + a_ + count_);
+  if (h.empty())
+    h.lo_ = 1;
+  return h;
+}
+
@@ -0,0 +1,81 @@
+/*
+ * newtfmt, working title, a Newton Script file reader and writer
+ * Copyright (C) 2025  Matthias Melcher
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef NEWTFMT_TOOLS_CONTENT_HASH_H
+#define NEWTFMT_TOOLS_CONTENT_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+/**
+ A 128 bit value that identifies a piece of content.
+ */
+struct ContentHash {
+  uint64_t lo_ { 0 };
+  uint64_t hi_ { 0 };
+  bool operator==(const ContentHash &other) const = default;
+  bool empty() const { return (lo_ == 0) && (hi_ == 0); }
+};
+
+/**
+ Use a ContentHash as the key in unordered containers.
+ */
+struct ContentHashKey {
+  size_t operator()(const ContentHash &h) const { return (size_t)h.lo_; }
+};
+
+class ContentHasher
+{
+  static constexpr uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+  static constexpr uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+  static constexpr uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+  static constexpr uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+
+  uint64_t a_;
+  uint64_t b_;
+  uint64_t count_ { 0 };
+
+  static uint64_t rotl64(uint64_t v, int n) { return (v << n) | (v >> (64 - n)); }
+  static uint64_t avalanche(uint64_t v);
+
+  void mix(uint64_t v) {
+    a_ = rotl64(a_ ^ (v * kPrime2), 31) * kPrime1;
+    b_ = rotl64(b_ + (v * kPrime4), 27) * kPrime3 + a_;
+    count_++;
+  }
+
+public:
+  /** Start a new hash, different seeds give unrelated hashes for the same content. */
+  ContentHasher(uint64_t seed = 0) : a_(seed + kPrime1), b_(seed ^ kPrime4) { }
+
+  /** Add a 32 bit word. */
+  void add(uint32_t v) { mix(v); }
+
+  /** Add another hash, for example the hash of a child node. */
+  void add(const ContentHash &h) { mix(h.lo_); mix(h.hi_); }
+
+  void add(std::span<const uint8_t> data);
+  void add(std::string_view text);
+  ContentHash finish() const;
+};
+
+#endif // NEWTFMT_TOOLS_CONTENT_HASH_H
+
@@ -0,0 +1,96 @@
+/*
+ * newtfmt, working title, a Newton Script file reader and writer
+ * Copyright (C) 2025  Matthias Melcher
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef NEWTFMT_TOOLS_GRAPH_WALKER_H
+#define NEWTFMT_TOOLS_GRAPH_WALKER_H
+
+#include <cstddef>
+#include <vector>
+
+/**
+ Visit a graph depth first, using a stack on the heap instead of recursion.
+
+ Object trees in packages can nest very deep, and recursing through them
+ can overflow the stack. The walker keeps one small entry per level on its
+ own stack, which is reused for every walk.
+
+ The walker knows nothing about the nodes. A visitor provides:
+ - `bool enter(Node node)`, called when a node is reached. It returns
+   false if the children must not be visited, and leave() is not called.
+ - `bool next(Node node, size_t &i, Node &child)`, called to find the
+   next child of a node. \p i is the index of the next edge, starting at 0
+   for every node. The visitor skips edges that it is not interested in,
+   sets \p child, and moves \p i past that edge. It returns false if the
+   node has no more children.
+ - `void leave(Node node)`, called after all children were visited, so
+   children are always left before their parents.
+
+ enter() and leave() may start a nested walk with the same walker, next()
+ must not.
+
+ The walker does not detect cycles or nodes that were visited before. The
+ visitor does that, usually by marking nodes in enter() and not following
+ edges to marked nodes. A node that was entered, but not left yet, is on
+ the current path, so an edge to it closes a cycle.
+ */
+template<typename Node>
+class GraphWalker
+{
+  struct Entry {
+    Node node_;
+    size_t next_;
+  };
+  std::vector<Entry> stack_;
+
+public:
+  GraphWalker() = default;
+  GraphWalker(GraphWalker const& rhs) = delete;
+  GraphWalker& operator=(GraphWalker const& rhs) = delete;
+
+  /** Number of nodes on the current path, including the current node. */
+  size_t depth() const { return stack_.size(); }
+
+  /**
+   Visit all nodes that can be reached from a root node.
+   \param[in] root start here
+   \param[in] visitor decides which edges to follow, see GraphWalker
+   */
+  template<typename Visitor>
+  void walk(Node root, Visitor &visitor) {
+    size_t base = stack_.size();
+    if (!visitor.enter(root))
+      return;
+    stack_.push_back({ root, 0 });
+    while (stack_.size() > base) {
+      Entry &top = stack_.back();
+      Node child { };
+      if (visitor.next(top.node_, top.next_, child)) {
+        if (visitor.enter(child))
+          stack_.push_back({ child, 0 });
+      } else {
+        Node node = top.node_;
+        stack_.pop_back();
+        visitor.leave(node);
+      }
+    }
+  }
+};
+
+#endif // NEWTFMT_TOOLS_GRAPH_WALKER_H
+
@@ -0,0 +1,100 @@
+/*
+ * newtfmt, working title, a Newton Script file reader and writer
+ * Copyright (C) 2025  Matthias Melcher
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "output_capture.h"
+
+/** \class OutputCapture
+ Redirect text written to a stream into a per-thread string.
+
+ The package reader reports warnings and errors directly to std::cout. When
+ many packages are processed in parallel, an OutputCapture installed on
+ std::cout lets each worker collect the messages for the package it is
+ working on. Threads that did not call begin() write through to the original
+ stream, one call at a time.
+
+ \note The formatting flags of the stream are still shared by all threads.
+ */
+
+thread_local std::string *OutputCapture::target_ { nullptr };
+
+/**
+ Install the capture on a stream.
+ \param[in] stream usually std::cout
+ */
+OutputCapture::OutputCapture(std::ostream &stream)
+: stream_(stream)
+{
+  original_ = stream_.rdbuf(this);
+}
+
+/**
+ Restore the original stream buffer.
+ */
+OutputCapture::~OutputCapture()
+{
+  stream_.flush();
+  stream_.rdbuf(original_);
+}
+
+/**
+ Send all output of the calling thread to a string until end() is called.
+ \param[in] target the output is appended to this string
+ */
+void OutputCapture::begin(std::string &target)
+{
+  target_ = &target;
+}
+
+/**
+ Stop capturing the output of the calling thread.
+ */
+void OutputCapture::end()
+{
+  target_ = nullptr;
+}
+
+int OutputCapture::overflow(int c)
+{
+  if (c == traits_type::eof())
+    return traits_type::not_eof(c);
+  if (target_) {
+    target_->push_back((char)c);
+    return c;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  return original_->sputc((char)c);
+}
+
+std::streamsize OutputCapture::xsputn(const char *s, std::streamsize n)
+{
+  if (target_) {
+    target_->append(s, (size_t)n);
+    return n;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  return original_->sputn(s, n);
+}
+
+int OutputCapture::sync()
+{
+  if (target_)
+    return 0;
+  std::lock_guard<std::mutex> lock(mutex_);
+  return original_->pubsync();
+}
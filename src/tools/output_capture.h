@@ -0,0 +1,50 @@
+/*
+ * newtfmt, working title, a Newton Script file reader and writer
+ * Copyright (C) 2025  Matthias Melcher
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef NEWTFMT_TOOLS_OUTPUT_CAPTURE_H
+#define NEWTFMT_TOOLS_OUTPUT_CAPTURE_H
+
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+
+class OutputCapture : public std::streambuf
+{
+  std::ostream &stream_;
+  std::streambuf *original_ { nullptr };
+  std::mutex mutex_;
+  static thread_local std::string *target_;
+
+protected:
+  int overflow(int c) override;
+  std::streamsize xsputn(const char *s, std::streamsize n) override;
+  int sync() override;
+
+public:
+  OutputCapture(std::ostream &stream);
+  ~OutputCapture() override;
+  OutputCapture(OutputCapture const& rhs) = delete;
+  OutputCapture& operator=(OutputCapture const& rhs) = delete;
+
+  static void begin(std::string &target);
+  static void end();
+};
+
+#endif // NEWTFMT_TOOLS_OUTPUT_CAPTURE_H
@@ -0,0 +1,157 @@
+/*
+ * newtfmt, working title, a Newton Script file reader and writer
+ * Copyright (C) 2025  Matthias Melcher
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "thread_pool.h"
+
+/** \class ThreadPool
+ A fixed set of worker threads that run queued tasks.
+
+ Every worker has its own task queue. New tasks are distributed round robin.
+ A worker takes tasks from the back of its own queue, and when that is empty,
+ steals from the front of the other queues, so that a few long tasks don't
+ leave the other workers idle.
+
+ The number of queued tasks can be limited. submit() then blocks until a
+ worker has picked up a task, which keeps a producer that reads a long list
+ of files from running far ahead of the workers.
+ */
+
+/**
+ Create the pool and start the worker threads.
+ \param[in] num_threads number of workers, or 0 for one per hardware thread
+ \param[in] max_queued maximum number of tasks waiting to run, or 0 for
+      four times the number of workers
+ */
+ThreadPool::ThreadPool(unsigned num_threads, size_t max_queued)
+{
+  if (num_threads == 0)
+    num_threads = std::thread::hardware_concurrency();
+  if (num_threads == 0)
+    num_threads = 1;
+  max_queued_ = max_queued ? max_queued : num_threads * 4;
+  for (unsigned i = 0; i < num_threads; ++i)
+    queues_.push_back(std::make_unique<Queue>());
+  for (unsigned i = 0; i < num_threads; ++i)
+    threads_.emplace_back([this, i]() { run(i); });
+}
+
+/**
+ Run all remaining tasks, then stop and join the worker threads.
+ */
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  work_cv_.notify_all();
+  for (auto &t: threads_)
+    t.join();
+}
+
+/**
+ Queue a task to be run by one of the workers.
+ Blocks while the maximum number of tasks is already waiting.
+ \param[in] task the function to run; it must not throw
+ */
+void ThreadPool::submit(std::function<void()> task)
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  space_cv_.wait(lock, [this]() { return queued_ < max_queued_; });
+  Queue &q = *queues_[next_queue_++ % queues_.size()];
+  {
+    std::lock_guard<std::mutex> q_lock(q.mutex_);
+    q.tasks_.push_back(std::move(task));
+  }
+  ++queued_;
+  lock.unlock();
+  work_cv_.notify_one();
+}
+
+/**
+ Wait until all submitted tasks have finished.
+ */
+void ThreadPool::wait()
+{
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_cv_.wait(lock, [this]() { return (queued_ == 0) && (active_ == 0); });
+}
+
+/**
+ Take the next task, preferring the worker's own queue.
+ \param[in] self index of the calling worker
+ \param[out] task receives the task
+ \return true if a task was found
+ */
+bool ThreadPool::pop(unsigned self, std::function<void()> &task)
+{
+  unsigned n = (unsigned)queues_.size();
+  for (unsigned i = 0; i < n; ++i) {
+    Queue &q = *queues_[(self + i) % n];
+    std::lock_guard<std::mutex> q_lock(q.mutex_);
+    if (q.tasks_.empty())
+      continue;
+    if (i == 0) {
+      task = std::move(q.tasks_.back());
+      q.tasks_.pop_back();
+    } else {
+      task = std::move(q.tasks_.front());
+      q.tasks_.pop_front();
+    }
+    return true;
+  }
+  return false;
+}
+
+/**
+ Worker thread main loop.
+ \param[in] self index of this worker
+ */
+void ThreadPool::run(unsigned self)
+{
+  std::function<void()> task;
+  for (;;) {
+    if (pop(self, task)) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --queued_;
+        ++active_;
+      }
+      space_cv_.notify_one();
+      task();
+      task = nullptr;
+      bool idle;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --active_;
+        idle = (queued_ == 0) && (active_ == 0);
+      }
+      if (idle)
+        idle_cv_.notify_all();
+    } else {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (stop_ && (queued_ == 0))
+        return;
+      work_cv_.wait(lock, [this]() { return stop_ || (queued_ > 0); });
+      if (stop_ && (queued_ == 0))
+        return;
+    }
+  }
+}
+
@@ -0,0 +1,81 @@
+/*
+ * newtfmt, working title, a Newton Script file reader and writer
+ * Copyright (C) 2025  Matthias Melcher
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef NEWTFMT_TOOLS_THREAD_POOL_H
+#define NEWTFMT_TOOLS_THREAD_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <latch>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+  struct Queue {
+    std::mutex mutex_;
+    std::deque<std::function<void()>> tasks_;
+  };
+
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable space_cv_;
+  std::condition_variable idle_cv_;
+  size_t max_queued_ { 0 };
+  size_t queued_ { 0 };
+  size_t active_ { 0 };
+  unsigned next_queue_ { 0 };
+  bool stop_ { false };
+
+  bool pop(unsigned self, std::function<void()> &task);
+  void run(unsigned self);
+
+public:
+  ThreadPool(unsigned num_threads = 0, size_t max_queued = 0);
+  ~ThreadPool();
+  ThreadPool(ThreadPool const& rhs) = delete;
+  ThreadPool& operator=(ThreadPool const& rhs) = delete;
+
+  unsigned size() const { return (unsigned)threads_.size(); }
+  void submit(std::function<void()> task);
+  void wait();
+};
+
+/**
+ Count down a latch when a task ends, even if the task ends with an
+ exception, so that the thread waiting for the latch is always released.
+ */
+class LatchGuard
+{
+  std::latch &latch_;
+public:
+  explicit LatchGuard(std::latch &latch) : latch_(latch) { }
+  ~LatchGuard() { latch_.count_down(); }
+  LatchGuard(LatchGuard const& rhs) = delete;
+  LatchGuard& operator=(LatchGuard const& rhs) = delete;
+};
+
+#endif // NEWTFMT_TOOLS_THREAD_POOL_H
+
@@ -19,6 +19,8 @@
 
 #include "tools.h"
 
+#include "asm_writer.h"
+
 #include <iostream>
 #include <fstream>
 #include <ios>
@@ -47,8 +49,8 @@ std::u16string utf8_to_utf16(std::string &str) {
 
 #pragma clang diagnostic pop
 
-int write_utf16(std::ofstream &f, std::string &u8str) {
-  f << "\t@ \"" << u8str << "\"" << std::endl;
+int write_utf16(AsmWriter &f, std::string &u8str) {
+  f << "\t@ \"" << u8str << "\"" << '\n';
   f << "\t.short\t";
   auto str16 = utf8_to_utf16(u8str);
   for (auto c: str16) {
@@ -57,29 +59,32 @@ int write_utf16(std::ofstream &f, std::string &u8str) {
     else if (c>=32 && c<127)
       f << "'" << (char)c << "', ";
     else
-      f << "0x" << std::setw(4) << std::hex << (uint16_t)c << std::dec << ", ";
+      f << "0x" << AsmHex((uint16_t)c, 4) << ", ";
   }
-  f << "0x0000" << std::endl;
+  f << "0x0000" << '\n';
   return ((int)str16.size()+1) * 2;
 }
 
-int write_data(std::ofstream &f, std::vector<uint8_t> &data) {
+int write_data(AsmWriter &f, std::span<const uint8_t> data) {
+  static const char hex[] = "0123456789abcdef";
   int i, j, n = (int)data.size();
+  char line[80];
   for (i = 0; i < n; i+=8) {
-    f << "\t.byte\t";
+    // Format a whole line at once, this is called for every byte of data.
+    char *d = line;
+    *d++ = '\t'; *d++ = '.'; *d++ = 'b'; *d++ = 'y'; *d++ = 't'; *d++ = 'e'; *d++ = '\t';
     for (j = 0; j < 8 && i+j < n; j++) {
-      if (j>0) f << ", ";
-      f << "0x" << std::setw(2) << std::hex << (int)data[i+j] << std::dec;
+      if (j>0) { *d++ = ','; *d++ = ' '; }
+      uint8_t c = data[i+j];
+      *d++ = '0'; *d++ = 'x'; *d++ = hex[c>>4]; *d++ = hex[c&15];
     }
-    f << "\t@ |";
+    *d++ = '\t'; *d++ = '@'; *d++ = ' '; *d++ = '|';
     for (j = 0; j < 8 && i+j < n; j++) {
       uint8_t c = data[i+j];
-      if (c>=32 && c<127)
-        f << (char)c;
-      else
-        f << ".";
+      *d++ = (c>=32 && c<127) ? (char)c : '.';
     }
-    f << "|" << std::endl;
+    *d++ = '|'; *d++ = '\n';
+    f << std::string_view(line, (size_t)(d - line));
   }
   return n;
 }
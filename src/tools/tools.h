@@ -21,11 +21,15 @@
 #define NEWTFMT_TOOLS_TOOLS_H
 
 #include <string>
+#include <span>
+#include <cstdint>
+
+class AsmWriter;
 
 std::string utf16_to_utf8(std::u16string &wstr);
 std::u16string utf8_to_utf16(std::string &str);
-int write_utf16(std::ofstream &f, std::string &u8str);
-int write_data(std::ofstream &f, std::vector<uint8_t> &data);
+int write_utf16(AsmWriter &f, std::string &u8str);
+int write_data(AsmWriter &f, std::span<const uint8_t> data);
 std::string unicode_to_utf8(char32_t c);
 
 #endif // NEWTFMT_TOOLS_TOOLS_H